@@ -0,0 +1,150 @@
+#ifndef ALARMS_H
+#define ALARMS_H
+
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "globals.h"
+#include "clock.h"
+
+//******************************************************************************
+//                              alarm table
+//ALARM_COUNT alarms, each with its time, the weekdays it rings on, an enable
+//flag and its own snooze length. alarm_schedule() works out which of them
+//rings next as a minute of the week, alarm_next, and alarm_handler() then
+//only compares that key with the week_minute of the calendar (clock.h) on
+//every tick, however many alarms there are. The key is worked out again only
+//when the clock is set, an alarm is edited, the minute of the last one is
+//over, or on a snooze.
+//
+//Weekday 0 is Sunday. ALARM_MODE edits one alarm at a time through my_alarm,
+//which alarm_load() and alarm_store() copy from and to the table.
+//******************************************************************************
+#define ALARM_COUNT      4
+#define ALARM_WEEK       (7 * 24 * 60) //minutes, week_minute runs 0 to ALARM_WEEK - 1
+#define ALARM_NEVER      0xFFFF        //alarm_next with no alarm enabled
+#define ALARM_EVERY_DAY  0x7F          //days: bit 0 Sunday to bit 6 Saturday
+#define ALARM_WEEKDAYS   0x3E
+#define ALARM_WEEKENDS   0x41
+#define ALARM_SNOOZE_MIN 10            //default snooze, minutes
+
+typedef struct {
+	uint8_t hour;
+	uint8_t minute;
+	uint8_t days;    //weekdays it rings on
+	uint8_t snooze;  //minutes
+	uint8_t enabled;
+} alarm_t;
+
+alarm_t alarms[ALARM_COUNT] = {
+	{0, 0, ALARM_EVERY_DAY, ALARM_SNOOZE_MIN, true}, //the alarm of old
+	{0, 0, ALARM_EVERY_DAY, ALARM_SNOOZE_MIN, false},
+	{0, 0, ALARM_EVERY_DAY, ALARM_SNOOZE_MIN, false},
+	{0, 0, ALARM_EVERY_DAY, ALARM_SNOOZE_MIN, false},
+};
+uint8_t  alarm_sel = 0;                  //the alarm ALARM_MODE edits
+uint16_t alarm_next = ALARM_NEVER;       //key of the next alarm or snooze
+uint8_t  alarm_next_idx;                 //alarm it belongs to
+bool     alarm_fired = false;            //the clock reached alarm_next
+
+//******************************************************************************
+//                              alarm_schedule
+//The enabled alarm that rings next, counting the current minute, becomes
+//alarm_next. A pending snooze is dropped. Called again whenever the clock
+//was set.
+//******************************************************************************
+void alarm_schedule(void) {
+	uint16_t now = clock_calendar()->week_minute;
+	uint16_t today = now - now % (24 * 60);
+	uint16_t best = ALARM_WEEK; //minutes until alarm_next
+	uint8_t  day = now / (24 * 60);
+
+	alarm_next = ALARM_NEVER;
+	alarm_fired = false;
+	for (uint8_t i = 0; i < ALARM_COUNT; i++) {
+		const alarm_t *a = &alarms[i];
+		uint16_t at = today + a->hour * 60 + a->minute; //its time today
+		uint8_t d = day;
+
+		if (!a->enabled || !(a->days & ALARM_EVERY_DAY)) {continue;}
+		if (at < now) {at += 24 * 60; d = d == 6 ? 0 : d + 1;} //today's is past
+		while (!(a->days & (1 << d))) {at += 24 * 60; d = d == 6 ? 0 : d + 1;}
+		if (at - now < best) {
+			best = at - now;
+			alarm_next = at % ALARM_WEEK;
+			alarm_next_idx = i;
+		}
+	}
+}
+
+//******************************************************************************
+//                          editing and snoozing
+//alarm_load() shows the selected alarm in my_alarm, alarm_store() keeps an
+//edit of it. A snooze rings the alarm that fired again its snooze length
+//later; alarm_snooze_end() drops it.
+//******************************************************************************
+void alarm_load(void) {
+	my_alarm.hour = alarms[alarm_sel].hour;
+	my_alarm.minute = alarms[alarm_sel].minute;
+}
+
+void alarm_store(void) {
+	alarms[alarm_sel].hour = my_alarm.hour;
+	alarms[alarm_sel].minute = my_alarm.minute;
+	alarm_schedule();
+}
+
+//the next alarm of the table, from ALARM_MODE
+void alarm_select_next(void) {
+	alarm_sel = alarm_sel == ALARM_COUNT - 1 ? 0 : alarm_sel + 1;
+	alarm_load();
+}
+
+//every day, weekdays, weekends and around again
+void alarm_days_next(void) {
+	uint8_t *days = &alarms[alarm_sel].days;
+
+	*days = *days == ALARM_EVERY_DAY ? ALARM_WEEKDAYS
+	      : *days == ALARM_WEEKDAYS  ? ALARM_WEEKENDS
+	      : ALARM_EVERY_DAY;
+	alarm_schedule();
+}
+
+void alarm_enable_toggle(void) {
+	alarms[alarm_sel].enabled = !alarms[alarm_sel].enabled;
+	alarm_schedule();
+}
+
+void alarm_snooze(void) {
+	uint16_t at;
+
+	if (!alarm_engaged) {return;} //nothing is ringing
+	at = clock_calendar()->week_minute + alarms[alarm_next_idx].snooze;
+	alarm_next = at >= ALARM_WEEK ? at - ALARM_WEEK : at;
+	alarm_fired = false;
+}
+
+void alarm_snooze_end(void) {
+	alarm_schedule();
+}
+
+//LCD line 1 of ALARM_MODE, e.g. "AL1 ON  MON-FRI"; line holds 16 and the NUL
+void alarm_describe(char *line) {
+	const alarm_t *a = &alarms[alarm_sel];
+
+	line[0] = 'A';
+	line[1] = 'L';
+	line[2] = '1' + alarm_sel;
+	line[3] = ' ';
+	strcpy_P(&line[4], a->enabled ? PSTR("ON  ") : PSTR("OFF "));
+	strcpy_P(&line[8], a->days == ALARM_EVERY_DAY ? PSTR("DAILY")
+	                 : a->days == ALARM_WEEKDAYS  ? PSTR("MON-FRI")
+	                 : a->days == ALARM_WEEKENDS  ? PSTR("SAT+SUN")
+	                 : PSTR("CUSTOM"));
+}
+
+//changes whenever alarm_describe() would
+uint16_t alarm_shown(void) {
+	return alarm_sel << 8 | alarms[alarm_sel].enabled << 7 | alarms[alarm_sel].days;
+}
+
+#endif
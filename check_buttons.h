@@ -3,19 +3,53 @@
 
 
 //******************************************************************************/
-//                            chk_buttons                                      
-//Checks the state of the button number passed to it. It shifts in ones till
-//the button is pushed. Function returns a 1 only once per debounced button
-//push so a debounce and toggle function can be implemented at the same time.
-//Adapted to check all buttons from Ganssel's "Guide to Debouncing" Expects
-//active low pushbuttons on PINA port.  Debounce time is determined by external
-//loop delay times 12. 
+//                            chk_buttons
+//Debounces all eight active low pushbuttons of PINA at once with a 3 bit
+//vertical counter: bit n of cnt0/cnt1/cnt2 is the counter of button n. A
+//counter is held at 7 while the raw input agrees with the debounced state
+//and counts down on every sample that disagrees; the 8th disagreeing sample
+//in a row wraps it and flips the debounced state, so a bounce restarts the
+//count. Called once per TIMER2 tick, which makes the debounce time 8 ms.
+//
+//Every flip is reported once as a press or a release. A state held for
+//BUTTON_LONG_TICKS reports a long press of the held buttons, and after that
+//the buttons in BUTTON_REPEAT_MASK repeat every BUTTON_REPEAT_TICKS. The
+//masks below hold the events of the last sample only. A change of any
+//button restarts the hold time, as one timer serves all eight.
 //******************************************************************************/
-uint8_t chk_buttons(uint8_t button) {
-	static uint16_t state[8] = {0}; //holds present state
-	state[button] = (state[button] << 1) | (! bit_is_clear(PINA, button)) | 0xE000; //establishes state of button
-	if (state[button] == 0xF000) return 1; //if 4 MSB's are high return 1
-	return 0;
+#define BUTTON_LONG_TICKS   500  //ticks to a long press, about 0.5 s
+#define BUTTON_REPEAT_TICKS 100  //ticks between repeats, about 0.1 s
+#define BUTTON_REPEAT_MASK  ((1 << 1) | (1 << 2)) //hour and minute select
+
+uint8_t button_state = 0;   //debounced, 1 = held down
+uint8_t button_press = 0;   //events of the last sample, one bit per button
+uint8_t button_release = 0;
+uint8_t button_long = 0;
+uint8_t button_repeat = 0;
+
+void chk_buttons(uint8_t raw) { //raw: 1 = pressed, i.e. ~PINA
+	static uint8_t cnt0 = 0xFF, cnt1 = 0xFF, cnt2 = 0xFF;
+	static uint16_t held = 0; //ticks since the last flip
+	uint8_t delta = raw ^ button_state;
+	uint8_t borrow = ~cnt0;
+
+	cnt2 = (cnt2 ^ (borrow & ~cnt1)) | ~delta;
+	cnt1 = (cnt1 ^ borrow) | ~delta;
+	cnt0 = borrow | ~delta;
+	delta &= cnt0 & cnt1 & cnt2; //counters that just wrapped
+
+	button_state ^= delta;
+	button_press = button_state & delta;
+	button_release = ~button_state & delta;
+	button_long = 0;
+	button_repeat = 0;
+
+	if (delta || !button_state) {held = 0;}
+	else if (++held == BUTTON_LONG_TICKS) {button_long = button_state;}
+	else if (held == BUTTON_LONG_TICKS + BUTTON_REPEAT_TICKS) {
+		held = BUTTON_LONG_TICKS;
+		button_repeat = button_state & BUTTON_REPEAT_MASK;
+	}
 }
 
 #endif
@@ -0,0 +1,223 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdbool.h>
+#include <string.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+//******************************************************************************
+//                                  clock
+//The time is one count, clock_seconds, the seconds since 2000-01-01 0:00,
+//a Saturday. The TIMER0 ISR only counts it on (clock_tick()); there is no
+//ripple of seconds into minutes and hours there, and a uint32_t lasts until
+//2136.
+//
+//clock_calendar() breaks the count down into the time, weekday and date when
+//main() asks for it, a view or the alarm scheduler. The breakdown is cached:
+//within the same minute only the second is worked out, by a subtraction.
+//The 32-bit divisions are made once a minute and the date once a day. The
+//cache belongs to main(), so ISRs must not call clock_calendar().
+//******************************************************************************
+#define CLOCK_DAY           86400UL //seconds
+#define CLOCK_EPOCH_YEAR    2000
+#define CLOCK_EPOCH_WEEKDAY 6       //2000-01-01 was a Saturday, Sunday is 0
+
+//******************************************************************************
+//                              drift trim
+//The 32.768 kHz crystal of TIMER0 is off by its calibration error, and
+//slows down on a parabola either side of its turnover temperature, by about
+//1 s a day 18 degrees away from it. clock_trim() turns that into the time
+//one overflow of TIMER0 really takes, a whole part, clock_whole, and a
+//fraction in 2^-32 s, clock_frac_step. clock_tick() adds the fraction up
+//and counts the whole part plus its carry: one add and one compare a
+//second, which gains a second whenever the clock has fallen a second
+//behind, or holds one back when it has run a second ahead.
+//
+//CLOCK_CAL_PPM is measured against a reference near the turnover, e.g. the
+//seconds gained over a week: +6 s is 6 / 604800 = +9.9 ppm, so build with
+//DEFS=-DCLOCK_CAL_PPM=9.9. The parabola is the crystal's datasheet
+//coefficient; the LM73 on the board stands in for the crystal's
+//temperature.
+//******************************************************************************
+#ifndef CLOCK_CAL_PPM
+#define CLOCK_CAL_PPM      0.0    //crystal error at the turnover, + runs fast
+#endif
+#define CLOCK_TURNOVER_C   25     //degrees C
+#define CLOCK_PARABOLA_PPM -0.034 //per degree C squared
+#define CLOCK_LM73_C       128    //LM73 counts per degree C
+#define CLOCK_PPB(ppm)     ((int32_t)((ppm) * 1000 + ((ppm) < 0 ? -0.5 : 0.5))) //rounded at compile time
+
+typedef struct {
+	uint16_t year;
+	uint8_t  month;       //1 to 12
+	uint8_t  day;         //of the month, 1 to 31
+	uint8_t  weekday;     //0 Sunday to 6 Saturday
+	uint8_t  hour;
+	uint8_t  minute;
+	uint8_t  second;
+	uint16_t week_minute; //minute of the week, Sunday 0:00 is 0
+} calendar_t;
+
+volatile uint32_t clock_seconds = 0;
+uint8_t  clock_whole = 1;          //seconds of one TIMER0 overflow, with
+uint32_t clock_frac_step = 0;      //the fraction of one, see above
+uint32_t clock_frac = 0;           //fractions of a second counted so far
+
+static calendar_t clock_cal;            //breakdown of the minute below
+static uint32_t   clock_cal_minute;     //clock_seconds at the start of its minute
+static uint16_t   clock_cal_days;       //days since the epoch of its date
+static bool       clock_cal_valid = false;
+
+static const char    clock_weekdays[] PROGMEM = "SUNMONTUEWEDTHUFRISAT";
+static const uint8_t clock_month_days[12] PROGMEM = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+static bool clock_leap(uint16_t year) {
+	return !(year % 4) && (year % 100 || !(year % 400));
+}
+
+//******************************************************************************
+//                              clock_tick
+//From the TIMER0 ISR, once a second of the crystal. Returns the seconds
+//counted, 1, or 2 or 0 when the trim added or held one back.
+//******************************************************************************
+uint8_t clock_tick(void) {
+	uint32_t frac = clock_frac + clock_frac_step;
+	uint8_t  step = clock_whole + (frac < clock_frac); //the carry
+
+	clock_frac = frac;
+	clock_seconds += step;
+	return step;
+}
+
+//******************************************************************************
+//                              clock_trim
+//The error of the crystal at "temp", in LM73 counts, in ppb: positive when
+//it runs fast. clock_trim() sets the ISR up to take it out.
+//******************************************************************************
+int32_t clock_drift(int16_t temp) {
+	int16_t dt = (temp - CLOCK_TURNOVER_C * CLOCK_LM73_C) / 8; //16ths of a degree
+
+	return CLOCK_PPB(CLOCK_CAL_PPM) + (int32_t)dt * dt * CLOCK_PPB(CLOCK_PARABOLA_PPM) / 256;
+}
+
+void clock_trim(int32_t drift) {
+	uint32_t ppb = drift < 0 ? -drift : drift;
+	uint32_t step = ppb * 4 + ppb * 1208 / 4096; //2^-32 s: 4.29492 per ppb, 2^32 / 10^9 = 4.29497
+	uint8_t  sreg = SREG;
+
+	cli();
+	if (drift > 0) {clock_whole = 0; clock_frac_step = -step;} //1 s less the gain
+	else {clock_whole = 1; clock_frac_step = step;}            //1 s and the loss
+	SREG = sreg;
+}
+
+//clock_seconds as main() sees it, read in one piece
+uint32_t clock_read(void) {
+	uint8_t sreg = SREG;
+	uint32_t now;
+
+	cli();
+	now = clock_seconds;
+	SREG = sreg;
+	return now;
+}
+
+//the date and weekday of a day since the epoch, into clock_cal
+static void clock_date(uint16_t days) {
+	uint16_t year = CLOCK_EPOCH_YEAR;
+	uint8_t  month = 0, length;
+
+	clock_cal_days = days;
+	clock_cal.weekday = (days + CLOCK_EPOCH_WEEKDAY) % 7;
+	while (days >= (clock_leap(year) ? 366 : 365)) {
+		days -= clock_leap(year) ? 366 : 365;
+		year++;
+	}
+	for (;; month++) {
+		length = pgm_read_byte(&clock_month_days[month]) + (month == 1 && clock_leap(year));
+		if (days < length) {break;}
+		days -= length;
+	}
+	clock_cal.year = year;
+	clock_cal.month = month + 1;
+	clock_cal.day = days + 1;
+}
+
+//******************************************************************************
+//                              clock_calendar
+//The current time and date, from main() only. The fields stay put until the
+//next call.
+//******************************************************************************
+const calendar_t *clock_calendar(void) {
+	uint32_t now = clock_read();
+	uint16_t days, minutes; //of the day
+
+	if (clock_cal_valid && now - clock_cal_minute < 60) { //same minute
+		clock_cal.second = now - clock_cal_minute;
+		return &clock_cal;
+	}
+	days = now / CLOCK_DAY;
+	now -= days * CLOCK_DAY; //seconds of the day from here on
+	minutes = now / 60;
+	clock_cal.second = now - minutes * 60UL;
+	clock_cal.minute = minutes % 60;
+	clock_cal.hour = minutes / 60;
+	clock_cal_minute = days * CLOCK_DAY + minutes * 60UL;
+	if (!clock_cal_valid || days != clock_cal_days) {clock_date(days);}
+	clock_cal.week_minute = clock_cal.weekday * (24 * 60) + minutes;
+	clock_cal_valid = true;
+	return &clock_cal;
+}
+
+//the weekday and day of the month as of the last clock_calendar(), e.g.
+//"SAT 01"; text holds 7 with the NUL
+void clock_day_text(char *text) {
+	memcpy_P(text, &clock_weekdays[clock_cal.weekday * 3], 3);
+	text[3] = ' ';
+	text[4] = '0' + clock_cal.day / 10;
+	text[5] = '0' + clock_cal.day % 10;
+	text[6] = '\0';
+}
+
+//******************************************************************************
+//                          setting the clock
+//clock_set() starts the count over, clock_adjust() moves it by whole
+//seconds, so the second under way is kept. Both drop the cached breakdown.
+//******************************************************************************
+void clock_set(uint32_t seconds) {
+	uint8_t sreg = SREG;
+
+	cli();
+	clock_seconds = seconds;
+	clock_cal_valid = false;
+	SREG = sreg;
+}
+
+void clock_adjust(int32_t delta) {
+	uint8_t sreg = SREG;
+
+	cli();
+	clock_seconds += delta;
+	clock_cal_valid = false;
+	SREG = sreg;
+}
+
+//a new hour and minute of the same day
+void clock_set_time(uint8_t hour, uint8_t minute) {
+	uint8_t sreg = SREG;
+	const calendar_t *c;
+
+	cli(); //no second may tick between the breakdown and the change
+	c = clock_calendar();
+	clock_adjust(((int32_t)(hour - c->hour) * 60 + (minute - c->minute)) * 60);
+	SREG = sreg;
+}
+
+//the same time a day later (dir > 0) or earlier, not before the epoch
+void clock_day_step(int8_t dir) {
+	if (dir > 0) {clock_adjust(CLOCK_DAY);}
+	else if (clock_read() >= CLOCK_DAY) {clock_adjust(-(int32_t)CLOCK_DAY);}
+}
+
+#endif
@@ -0,0 +1,82 @@
+//eeprom_queue.c
+//EEPROM write queue, see eeprom_queue.h.
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "eeprom_queue.h"
+
+volatile uint8_t  ee_overflows;
+volatile uint16_t ee_programmed;
+volatile uint16_t ee_skipped;
+
+//Jobs waiting for the EEPROM. The one at ee_tail is being written, ee_next
+//bytes of it are done. ee_head is only written by ee_queue(), ee_tail only
+//by the ISR.
+typedef struct {
+  uint16_t       addr;  //EEPROM address of the first byte
+  const uint8_t *src;
+  uint8_t        len;
+} ee_job_t;
+
+static ee_job_t         ee_jobs[EE_QUEUE_SIZE];
+static volatile uint8_t ee_head, ee_tail;
+static uint8_t          ee_next;
+
+//****************************************************************************
+//Runs while EERIE is set and the EEPROM is not programming: starts the write
+//of the next byte that differs from its cell and returns, to come back when
+//it is done. Bytes that match only cost a read. Once the queue is empty the
+//interrupt is switched off.
+//****************************************************************************
+ISR(EE_READY_vect){
+  while (ee_head != ee_tail) {
+    ee_job_t *job = &ee_jobs[ee_tail];
+
+    while (ee_next < job->len) {
+      uint8_t value = job->src[ee_next];
+
+      EEAR = job->addr + ee_next++;
+      EECR |= (1 << EERE);         //read the cell into EEDR
+      if (EEDR == value) {ee_skipped++; continue;}
+      EEDR = value;
+      EECR |= (1 << EEMWE);        //EEWE has to follow within 4 cycles,
+      EECR |= (1 << EEWE);         //interrupts are off in here
+      ee_programmed++;
+      return;
+    }
+    ee_next = 0;
+    ee_tail = (ee_tail + 1) & (EE_QUEUE_SIZE - 1);
+  }
+  EECR &= ~(1 << EERIE);
+}
+
+//****************************************************************************
+//True until every byte queued so far is in the EEPROM, the last one
+//included: the flush status.
+//****************************************************************************
+uint8_t ee_busy(void){
+  return ee_head != ee_tail;
+}
+
+//****************************************************************************
+//Queues "len" bytes from "src" for the EEPROM at "addr". The buffer must stay
+//untouched until ee_busy() turns false. Never waits: returns 0 if the queue
+//is full. Callable from main() and from ISRs.
+//****************************************************************************
+uint8_t ee_queue(uint16_t addr, const void *src, uint8_t len){
+  uint8_t sreg = SREG;
+  uint8_t next;
+
+  cli();
+  next = (ee_head + 1) & (EE_QUEUE_SIZE - 1);
+  if (next == ee_tail) {
+    ee_overflows++;
+    SREG = sreg;
+    return 0;
+  }
+  ee_jobs[ee_head] = (ee_job_t){addr, src, len};
+  ee_head = next;
+  EECR |= (1 << EERIE);  //EE_READY is a level, taken as soon as the EEPROM is idle
+  SREG = sreg;
+  return 1;
+}
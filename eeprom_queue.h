@@ -0,0 +1,25 @@
+//eeprom_queue.h
+//Interrupt driven EEPROM writes. A job is a block of bytes for consecutive
+//EEPROM addresses; the EE_READY ISR programs them one byte per interrupt,
+//so nobody waits out the 8.5 ms a byte takes. Before programming a byte the
+//ISR reads the cell back and skips it if it already holds the value, which
+//saves the cell a write cycle as well as the time.
+//
+//While a job is under way the blocking avr-libc eeprom_* calls must not be
+//used, as the ISR moves EEAR under them; settings_load() reads before sei().
+
+#ifndef EEPROM_QUEUE_H
+#define EEPROM_QUEUE_H
+
+#include <stdint.h>
+
+#define EE_QUEUE_SIZE 4  //jobs, power of two, one slot kept free
+
+extern volatile uint8_t  ee_overflows;  //ee_queue() calls refused on a full queue
+extern volatile uint16_t ee_programmed; //bytes written
+extern volatile uint16_t ee_skipped;    //bytes that already held the value
+
+uint8_t ee_queue(uint16_t addr, const void *src, uint8_t len);
+uint8_t ee_busy(void);
+
+#endif
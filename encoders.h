@@ -1,92 +1,128 @@
 #ifndef ENCODERS_H
 #define ENCODERS_H
 
+#include <avr/pgmspace.h>
 #include "globals.h"
 #include "time.h"
+#include "input_events.h"
+
+volatile uint8_t encoder_errors = 0; //invalid transitions, missed samples or bounce
+
 //******************************************************************************
-//                              left_encoder
-//Takes the past encoder value and the present encoder value and shifts                                                             
-//them into an eight bit integer. This value is represented as a case in
-//a switch statement. Four cases are used to increase the volume and four cases
-//are used to decrease the volume. 
+//                              quad_table
+//Quarter step of one encoder, indexed by its past two bits << 2 | its present
+//two bits: +1 clockwise (10 00 01 11), -1 counter clockwise, 0 for no change
+//and ENC_INVALID when both bits changed, so the direction is unknown.
 //******************************************************************************/
-void left_encoder(uint8_t past_encoder, uint8_t  encoder) {
-	uint8_t direc = (past_encoder << 2 | encoder);
-	switch (direc) { //Determine whether to increase or decrease the volume
-		//Increase volume
-		case 0x01: 
-		case 0x0E:	  
-		case 0x08: 
-		case 0x07: OCR3A += 4;
-							 break;
-		//Decrease volume
-		case 0x04: 
-		case 0x0B: 
-		case 0x02: 
-		case 0x0D: OCR3A -= 4;
-							 break;
-		default: break;
-	}//switch
-
-}//left_encoder
+#define ENC_INVALID 2
+
+const int8_t quad_table[16] PROGMEM = {
+	 0,          +1,          -1,          ENC_INVALID,
+	-1,           0,          ENC_INVALID, +1,
+	+1,          ENC_INVALID,  0,          -1,
+	ENC_INVALID, -1,          +1,           0
+};
+#define quad_step(index) ((int8_t)pgm_read_byte(&quad_table[index]))
 
+//******************************************************************************
+//                             encoder_gain
+//Detent velocity estimate: the fewer ticks since the previous step, the
+//more each step counts, doubling for every halving of the gap below
+//ENC_SLOW_TICKS, up to "max".
 //******************************************************************************/
-//                             right_ encoder
-//Takes the past encoder value and the present encoder value and shifts
-//them into an eight bit integer. This value is represented as a case in a
-//switch statement. Each case is either skipped or increments the display value
-//in accord with the selected state. 
+#define ENC_SLOW_TICKS 64 //a gap of 64 ms or more is one step per step
+
+uint8_t encoder_gain(uint8_t gap, uint8_t max) {
+	uint8_t gain = 1;
+
+	while (gap < ENC_SLOW_TICKS && gain < max) {
+		gap <<= 1;
+		gain <<= 1;
+	}
+	return gain;
+}
+
+//******************************************************************************/
+//                             encoder_sample
+//Called from the TIMER2 ISR with the nibble read back from the 165. The upper
+//two bits are for the right encoder and the lower two are for the left; each
+//is decoded against its state on the previous call and every step is
+//pushed to the input ring as an EV_ENCODER event.
+//The left encoder counts every quarter step, up to 4 each when spun fast.
+//The right one counts once per detent, when it comes to rest at 11 at least
+//half a turn of the gray code away from the previous detent, up to 8 each.
 //******************************************************************************/
-void right_encoder(uint8_t past_encoder, uint8_t  encoder) {
-	volatile Time *modifier;
-	uint8_t direc = (past_encoder << 2 | encoder);
-	//switch statement for clock_mode only
-	switch (clock_mode) {
-		case TIME_MODE:
-		default:
-			modifier = &my_time;
-			break;
-		case ALARM_MODE:
-			modifier = &my_alarm;
-			break;
+void encoder_sample(uint8_t encoder) {
+	static uint8_t past_encoder = 0x0F; //both at rest on a detent
+	static int8_t right_quarters = 0;   //quarter steps since the last detent
+	static uint8_t left_gap = 0xFF, right_gap = 0xFF; //ticks since the last step
+	int8_t q;
+
+	if (left_gap < 0xFF) {left_gap++;}
+	if (right_gap < 0xFF) {right_gap++;}
+
+	q = quad_step((past_encoder & 0x0C) | (encoder >> 2));
+	if (q == ENC_INVALID) {encoder_errors++; right_quarters = 0;}
+	else {
+		right_quarters += q;
+		if ((encoder & 0x0C) == 0x0C && right_quarters) { //at a detent
+			if (right_quarters >= 2) {input_push(EV_ENCODER | ENC_RIGHT, encoder_gain(right_gap, 8)); right_gap = 0;}
+			else if (right_quarters <= -2) {input_push(EV_ENCODER | ENC_RIGHT, -encoder_gain(right_gap, 8)); right_gap = 0;}
+			right_quarters = 0;
+		}
 	}
 
+	q = quad_step((past_encoder & 0x03) << 2 | (encoder & 0x03));
+	if (q == ENC_INVALID) {encoder_errors++;}
+	else if (q) {
+		//a quarter step takes a quarter of the time of a detent
+		q *= encoder_gain(left_gap < 0x40 ? left_gap << 2 : 0xFF, 4);
+		input_push(EV_ENCODER | ENC_LEFT, q);
+		left_gap = 0;
+	}
+	past_encoder = encoder; //remember current state for next interrupt
+}
+
+//******************************************************************************/
+//                             volume_adjust
+//Each left encoder step moves the volume PWM by 4, stopping at the ends of
+//its 8 bit range instead of wrapping.
+//******************************************************************************/
+void volume_adjust(int8_t steps) {
+	int16_t volume;
+
+	if (steps) {
+		volume = OCR3A + 4 * steps;
+		OCR3A = volume < 0 ? 0 : volume > 0xFF ? 0xFF : volume;
+	}
+}
+
+//******************************************************************************/
+//                              time_adjust
+//Applies right encoder steps to the selected hour or minute of "modifier",
+//the clock or alarm time being set, or to the radio frequency in channel
+//steps of the current band (globals.h), depending on clock_mode. The radio
+//takes no modifier.
+//******************************************************************************/
+void time_adjust(volatile Time *modifier, int8_t steps) {
 	if (clock_mode == TIME_MODE || clock_mode == ALARM_MODE) {
-		//Determine direction of encoder for time adjustment
-		switch (direc) { 
-			case 0x07: //encoder turned right (increment)
-				if (time == TIME_SELECT_MINUTE) {modifier->minute++;} 
-				else if (time == TIME_SELECT_HOUR) {modifier->hour++;}	 
-				break;
-
-			case 0x0D: //encoder turned left (decrement)
-				if (time == TIME_SELECT_MINUTE) {modifier->minute--;} 
-				else if (time == TIME_SELECT_HOUR) {modifier->hour--;}
-				break;
-			default: break;
-		}//switch
+		if (time == TIME_SELECT_MINUTE) {modifier->minute += steps;}
+		else if (time == TIME_SELECT_HOUR) {modifier->hour += steps;}
 	}//if
 
 	if (clock_mode == RADIO_MODE) {
-
-		switch (direc) { 
-			case 0x07: //encoder turned right (increment)
-				//increase the current_fm_freq
-				if (current_fm_freq < 10790) {
-					encoder_freq += 20;
-				}
-				break;
-
-			case 0x0D: //encoder turned left (decrement)
-				//decrease the current_fm_freq
-				if (encoder_freq > 8810) {
-					encoder_freq -=20;
-				}
-				break;
-			default: break;
-		}//switch
-		
+		uint16_t step = band_step(current_radio_band);
+		for (; steps > 0; steps--) { //encoder turned right
+			if (encoder_freq + step <= band_high(current_radio_band)) {
+				encoder_freq += step;
+			}
+		}
+		for (; steps < 0; steps++) { //encoder turned left
+			if (encoder_freq >= band_low(current_radio_band) + step) {
+				encoder_freq -= step;
+			}
+		}
 	}
-}//right_encoder
+}//time_adjust
 
 #endif
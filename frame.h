@@ -0,0 +1,51 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <string.h>
+#include <avr/pgmspace.h>
+#include "hd44780.h"
+
+//******************************************************************************
+//                                LCD frames
+//Two 32 character frames laid out like lcd_string_array: line 1 in 0-15 and
+//line 2 in 16-31. lcd_task only reads the published one. A producer builds
+//the next frame in the other one with frame_edit() and makes it visible
+//with frame_publish(), a single index write, so the LCD never shows half of
+//an update. frame_edit() starts from a copy of the published frame, so a
+//producer writes only the line it owns, and only when it has something new.
+//Producers run from main() and do not interrupt each other.
+//******************************************************************************
+char lcd_frames[2][32];
+volatile uint8_t lcd_front = 0; //index of the published frame
+
+//the frame lcd_task shows
+const char *frame_front(void) {
+	return lcd_frames[lcd_front];
+}
+
+//the unpublished frame, starting out as a copy of the published one
+char *frame_edit(void) {
+	char *back = lcd_frames[lcd_front ^ 1];
+
+	memcpy(back, lcd_frames[lcd_front], sizeof(lcd_frames[0]));
+	return back;
+}
+
+void frame_publish(void) {
+	lcd_front ^= 1;
+}
+
+//writes text into a 16 character line, padded with spaces
+void frame_line(char *line, const char *text) {
+	uint8_t i;
+
+	for (i = 0; i < 16 && text[i]; i++) {line[i] = text[i];}
+	for (; i < 16; i++) {line[i] = ' ';}
+}
+
+//the same for text in flash, e.g. PSTR("ALARM:ON")
+void frame_line_P(char *line, PGM_P text) {
+	lcd_fill_P(line, text, 16);
+}
+
+#endif
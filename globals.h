@@ -2,53 +2,74 @@
 #define GLOBALS_H
 
 #include <stdbool.h>
+#include <avr/pgmspace.h>
+#include "si4734.h" //FM_BAND_BOTTOM and the rest of the FM band
 
 //Declare global variables
 
 //External variables
-extern uint8_t lm73_wr_buf[];
 extern uint8_t lm73_rd_buf[];
-extern char    lcd_string_array[];
 
 //Time variables
-volatile Time my_time = {0, 0, 0};
-volatile Time my_alarm = {0, 0, 0};
+volatile Time my_alarm = {0, 0, 0}; //the clock itself is clock_seconds, clock.h
 volatile TimeSelection time = TIME_SELECT_HOUR;
 volatile TimeSelection alarm = TIME_SELECT_HOUR;
 volatile ClockMode clock_mode = TIME_MODE;
 
 //Int variables for counts
-volatile uint8_t  snooze_count = 0; //snooze delay
-volatile uint8_t  end_of_string = 0;
-volatile uint16_t disp_value = 0; //7seg display
-volatile uint16_t disp_temp = 0;
-volatile uint16_t lm73_temp;
+volatile uint16_t disp_value = 0; //7seg display, packed BCD
+volatile uint8_t  disp_second = 0; //bar graph, the second of the clock
+volatile int16_t  disp_temp = 0;  //LM73 in tenths of a degree, as shown
+volatile uint16_t lm73_temp;      //LM73 reading after lm73_filter()
 
 //Alarm bools
 volatile bool alarm_toggle = false; 
 volatile bool alarm_engaged= false;
+volatile bool alarm_armed = false; //toggled by button 6, kept in the settings
 
 //Display variables
-char temperature [16];
-char alarm_array [16];
-char*  alarm_display    = &lcd_string_array[0];
-char*  temp_in_display  = &lcd_string_array[16];
+PGM_P alarm_text = NULL; //LCD line 1 in flash, set by display_task and alarm_handler
 
 //Radio Variables
 extern enum radio_band{FM, AM, SW};
 extern volatile uint8_t STC_interrupt;
 volatile enum radio_band current_radio_band = FM;
 
-uint16_t eeprom_fm_freq;
-uint16_t eeprom_am_freq;
-uint16_t eeprom_sw_freq;
-uint8_t  eeprom_volume;
-
 volatile uint16_t current_fm_freq;
 volatile uint16_t encoder_freq = 9990;
 uint16_t current_am_freq;
 uint16_t current_sw_freq;
 uint8_t  current_volume;
 
+//Band limits for the right encoder: FM in 10 kHz units, AM and SW in kHz
+typedef struct {
+	uint16_t low, high, step;
+	uint16_t start; //until the band has been tuned
+} band_t;
+
+const band_t bands[3] PROGMEM = {
+	{FM_BAND_BOTTOM, FM_BAND_TOP, FM_SPACING, 9990}, //FM, the Si4734's seek band
+	{530,  1700,  10, 1000},  //AM, 10 kHz channels
+	{2300, 21850, 5,  9500},  //SW, 5 kHz channels
+};
+
+#define band_low(b)  pgm_read_word(&bands[b].low)
+#define band_high(b) pgm_read_word(&bands[b].high)
+#define band_step(b) pgm_read_word(&bands[b].step)
+
+//last frequency of a band, or its start if it has none in range
+uint16_t band_freq(uint8_t band) {
+	uint16_t freq = band == FM ? current_fm_freq : band == AM ? current_am_freq : current_sw_freq;
+	return (freq < band_low(band) || freq > band_high(band)) ? pgm_read_word(&bands[band].start) : freq;
+}
+
+void band_freq_set(uint8_t band, uint16_t freq) {
+	switch (band) {
+		case FM: current_fm_freq = freq; break;
+		case AM: current_am_freq = freq; break;
+		case SW: current_sw_freq = freq; break;
+	}
+}
+
 
 #endif
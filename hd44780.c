@@ -12,41 +12,74 @@
 //Refactored, and cleaned up again by R. Traylor 12.28.2011, 12.30.2014
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <util/delay.h>
 #include <string.h>
 #include <stdlib.h>
 #include "hd44780.h"
+#include "spi.h"
 
 #define NUM_LCD_CHARS 16
 
-//If using an interrupt driven, one char at a time style lcd refresh
-//for a 2x16 display, use this array to place anything to be displayed
-char lcd_string_array[32];  //holds two strings to refresh the LCD
+//Shadow of the two visible lines of DDRAM, kept by lcd_queue() so it holds
+//what the LCD shows once the queue has drained, and the LCD's address
+//counter. A zero cell has not been written since reset (lcd_update() never
+//sends zeros).
+static uint8_t lcd_shadow[32];
+static uint8_t lcd_addr = LCD_ADDR_UNKNOWN;
+
+//shadow index of a DDRAM address, 32 when it is not on screen
+static uint8_t lcd_cell(uint8_t addr){
+  if (addr < NUM_LCD_CHARS) return addr;
+  if (addr >= 0x40 && addr < 0x40 + NUM_LCD_CHARS) return addr - 0x40 + NUM_LCD_CHARS;
+  return 32;
+}
 
-char lcd_str[16];  //holds string to send to lcd
+//DDRAM address of a shadow index
+static uint8_t lcd_ddram(uint8_t cell){
+  return (cell < NUM_LCD_CHARS) ? cell : cell - NUM_LCD_CHARS + 0x40;
+}
 
 //-----------------------------------------------------------------------------
-//                               send_lcd
+//                               lcd_track
 //
-// Sends a command or character data to the lcd. First argument of 0x00 indicates
-// a command transfer while 0x01 indicates data transfer.  The next byte is the
-// command or character byte.
+// Follows a byte sent to the LCD in the shadow. Assumes the entry mode
+// sent by lcd_init() (increment, no display shift).
 //
-// This is a low-level function usually called by the other functions but may
-// be called directly to provide more control. Most commonly controlled
-// commands require 37us to complete. Thus, this routine should be called no more
-// often than every 37us.
+static void lcd_track(uint8_t cmd_or_char, uint8_t byte){
+  uint8_t cell;
+
+  if (cmd_or_char) {
+    if (lcd_addr == LCD_ADDR_UNKNOWN) return;    //CGRAM or lost
+    cell = lcd_cell(lcd_addr);
+    if (cell < 32) lcd_shadow[cell] = byte;
+    lcd_addr++;
+    if      (lcd_addr == 0x28) lcd_addr = 0x40;  //DDRAM wraps line to line
+    else if (lcd_addr == 0x68) lcd_addr = 0x00;
+  }
+  else if (byte & SET_DDRAM_ADDR) lcd_addr = byte & 0x7F;
+  else if (byte == CLEAR_DISPLAY) {memset(lcd_shadow, ' ', sizeof(lcd_shadow)); lcd_addr = 0;}
+  else if ((byte & 0xFE) == RETURN_HOME) lcd_addr = 0;
+  else if (byte & 0x40) lcd_addr = LCD_ADDR_UNKNOWN;  //CGRAM address
+  else if ((byte & 0xF0) == 0x10) lcd_addr = LCD_ADDR_UNKNOWN;  //cursor/display shift
+}
+
+//-----------------------------------------------------------------------------
+//                               lcd_write
 //
-// Commnads that require more time have delays built in for them.
+// Puts a command or character on the LCD bus now. First argument of 0x00
+// indicates a command transfer while 0x01 indicates data transfer.
 //
-void send_lcd(uint8_t cmd_or_char, uint8_t byte){
+// In SPI mode the two bytes and the strobe are queued as one job (spi.c), so
+// the TIMER2 ISR's bar graph transfer cannot land in between. Once the SPI
+// interrupt is on this returns before the bytes are out; they follow within
+// a few microseconds.
+//
+static void lcd_write(uint8_t cmd_or_char, uint8_t byte){
 
 #if SPI_MODE==1
-  SPDR = (cmd_or_char)? 0x01 : 0x00;  //send the proper value for intent
-  while (bit_is_clear(SPSR,SPIF)){}   //wait till byte is sent out
-  SPDR = byte;                        //send payload
-  while (bit_is_clear(SPSR,SPIF)){}   //wait till byte is sent out
-  strobe_lcd();                       //strobe the LCD enable pin
+  spi_queue((cmd_or_char)? 0x01 : 0x00, byte, 2, SPI_STROBE_LCD, 0);
 #else //4-bit mode
   if(cmd_or_char==0x01){LCD_PORT |=  (1<<LCD_CMD_DATA_BIT);}
   else                 {LCD_PORT &= ~(1<<LCD_CMD_DATA_BIT);}
@@ -58,6 +91,127 @@ void send_lcd(uint8_t cmd_or_char, uint8_t byte){
 #endif
 }
 
+//-----------------------------------------------------------------------------
+//                            command queue
+//
+// Every byte for the LCD goes through a queue. Each entry carries the time
+// the LCD needs to execute it, and the next entry is released when that time
+// is up by a TIMER1 compare B interrupt instead of a busy delay. TIMER1 runs
+// in CTC mode for the alarm tone (OCR1A = 156, 4us per count), so OCR1B is
+// set that many counts ahead of TCNT1, wrapping at OCR1A; settle times longer
+// than one TIMER1 period are taken in several steps.
+//
+// Entries queued before sei() (lcd_init) go out once interrupts are on.
+//
+#define LCD_QUEUE_SIZE 64   //power of two; a repaint of the whole frame, 32
+                            //characters and 2 SET_DDRAM, fits with room to spare
+#define LCD_QUEUE_MASK (LCD_QUEUE_SIZE - 1)
+
+typedef struct {
+  uint8_t  type;     //CMD_BYTE, CHAR_BYTE or LCD_WAIT
+  uint8_t  byte;
+  uint16_t settle;   //TIMER1 counts after it is sent
+} lcd_cmd_t;
+
+static lcd_cmd_t         lcd_cmds[LCD_QUEUE_SIZE];
+static volatile uint8_t  lcd_head;   //next free entry
+static volatile uint8_t  lcd_tail;   //next entry to release
+static volatile uint8_t  lcd_busy;   //a settle time is running
+static uint16_t          lcd_wait;   //counts of it still to schedule
+
+//sets the compare for the next piece of lcd_wait, counted from "from"
+static void lcd_step(uint16_t from){
+  uint16_t top  = OCR1A;
+  uint16_t step = (lcd_wait < top)? lcd_wait : top;
+  uint16_t at   = from + step;
+
+  if (at > top) at -= top + 1;
+  lcd_wait -= step;
+  OCR1B = at;
+  TIFR   = (1 << OCF1B);  //a match from before does not count
+  TIMSK |= (1 << OCIE1B);
+}
+
+//sends the next queued entry and starts its settle time, interrupts off
+static void lcd_release(void){
+  lcd_cmd_t *cmd;
+
+  if (lcd_tail == lcd_head) {
+    TIMSK &= ~(1 << OCIE1B);
+    lcd_busy = 0;
+    return;
+  }
+  cmd = &lcd_cmds[lcd_tail];
+  if (cmd->type != LCD_WAIT) lcd_write(cmd->type, cmd->byte);
+  lcd_wait = cmd->settle;
+  lcd_tail = (lcd_tail + 1) & LCD_QUEUE_MASK;
+  lcd_busy = 1;
+  lcd_step(TCNT1);
+}
+
+//the settle time ran out, or the next piece of it is due
+ISR(TIMER1_COMPB_vect){
+  if (lcd_wait) lcd_step(OCR1B);
+  else lcd_release();
+}
+
+//-----------------------------------------------------------------------------
+//                               lcd_queue
+//
+// Queues a command (CMD_BYTE), a character (CHAR_BYTE) or a pause (LCD_WAIT)
+// that the LCD needs settle_us microseconds to carry out. Returns at once
+// unless the queue is full. The shadow is updated here, so it describes the
+// display once everything queued has gone out.
+//
+void lcd_queue(uint8_t type, uint8_t byte, uint16_t settle_us){
+  uint8_t sreg = SREG;
+  lcd_cmd_t *cmd;
+
+  if (type != LCD_WAIT) lcd_track(type, byte);
+  cli();
+  while (((lcd_head + 1) & LCD_QUEUE_MASK) == lcd_tail) {
+    if (sreg & (1 << SREG_I)) {
+      SREG = sreg;  //let TIMER1_COMPB drain it
+      while (((lcd_head + 1) & LCD_QUEUE_MASK) == lcd_tail){}
+      cli();
+    }
+    else {          //before sei(): run the deadline by polling
+      while (bit_is_clear(TIFR, OCF1B)){}
+      TIFR = (1 << OCF1B);
+      if (lcd_wait) lcd_step(OCR1B);
+      else lcd_release();
+    }
+  }
+  cmd = &lcd_cmds[lcd_head];
+  cmd->type   = type;
+  cmd->byte   = byte;
+  cmd->settle = LCD_COUNTS(settle_us);
+  lcd_head = (lcd_head + 1) & LCD_QUEUE_MASK;
+  if (!lcd_busy) lcd_release();
+  SREG = sreg;
+}
+
+//-----------------------------------------------------------------------------
+//                               send_lcd
+//
+// Sends a command or character data to the lcd. First argument of 0x00 indicates
+// a command transfer while 0x01 indicates data transfer.  The next byte is the
+// command or character byte.
+//
+// This is a low-level function usually called by the other functions but may
+// be called directly to provide more control. Most commonly controlled
+// commands require 37us to complete; the queue spaces them by LCD_SETTLE_US.
+// Commands that take longer go through lcd_queue() with their own time.
+//
+void send_lcd(uint8_t cmd_or_char, uint8_t byte){
+  lcd_queue(cmd_or_char, byte, LCD_SETTLE_US);
+}
+
+//nothing is left in the queue or executing
+uint8_t lcd_idle(void){
+  return !lcd_busy;
+}
+
 //------------------------------------------------------------------
 //                          refresh_lcd
 //
@@ -94,19 +248,16 @@ void refresh_lcd(char const* lcd_string_array) {
 
   i++;   //increment to next character
 
-  //delays are inserted to allow character to be written before moving
-  //the cursor to the next line.
+  //the queue spaces the character and the cursor move
   if(i == 16)
   {
       // goto line2, 1st char
-      _delay_us(40);
       line2_col1();
 			null_flag = 0;
   }
   else if(i == 32)
   {
       // goto line1, 1st char
-      _delay_us(40);
       line1_col1();
       null_flag=0;
       i=0;
@@ -114,6 +265,41 @@ void refresh_lcd(char const* lcd_string_array) {
 }//refresh_lcd
 /***********************************************************************/
 
+//------------------------------------------------------------------
+//                          lcd_update
+//
+//Brings the LCD up to date with a 32 char frame, organized as for
+//refresh_lcd() (a null ends its line early, the rest shows spaces).
+//Only the cells that differ from the shadow are sent. The cursor is
+//moved with SET_DDRAM_ADDR only where the next changed cell is not
+//where the address counter already points; a single unchanged cell
+//in between is written again instead, which costs the same and
+//saves the jump. A static frame sends nothing.
+//
+//The bytes are only queued, so even a full repaint returns in
+//microseconds and reaches the LCD over about 1.6ms.
+//
+void lcd_update(char const* frame) {
+  uint8_t i, c;
+  uint8_t end = 0;   //a null was found on this line
+
+  for (i = 0; i < 32; i++) {
+    if (i == NUM_LCD_CHARS) end = 0;
+    if (frame[i] == '\0') end = 1;
+    c = end ? ' ' : frame[i];
+    if (c == lcd_shadow[i]) continue;
+
+    if (lcd_addr != lcd_ddram(i)) {
+      if (i % NUM_LCD_CHARS && lcd_addr == lcd_ddram(i - 1))
+        send_lcd(CHAR_BYTE, lcd_shadow[i - 1]);  //rewrite the cell in between
+      else
+        send_lcd(CMD_BYTE, SET_DDRAM_ADDR | lcd_ddram(i));
+    }
+    send_lcd(CHAR_BYTE, c);
+  }
+}//lcd_update
+/***********************************************************************/
+
 //-----------------------------------------------------------------------------
 //                          set_custom_character
 //
@@ -141,9 +327,9 @@ void refresh_lcd(char const* lcd_string_array) {
 
 void set_custom_character(uint8_t data[], uint8_t address){
     uint8_t i;
-    send_lcd(CMD_BYTE, 0x40 + (address << 3)); _delay_us(40);  //only needs 37uS
+    send_lcd(CMD_BYTE, 0x40 + (address << 3));  //only needs 37uS
     for(i=0; i<8; i++){
-      send_lcd(CHAR_BYTE, data[i]); _delay_us(40); //each char byte takes 37us to execute
+      send_lcd(CHAR_BYTE, data[i]); //each char byte takes 37us to execute
     }
 }
 
@@ -197,8 +383,8 @@ void uint16_2lcd(uint16_t number){
 //
 void int2lcd(int8_t number){
     //if < 0, print minus sign, then take 2's complement of number and display
-    if(number < 0){send_lcd(CHAR_BYTE, '-'); _delay_us(40); uint8_2lcd(~number+1);}
-    else          {uint8_2lcd(number);                                            }
+    if(number < 0){send_lcd(CHAR_BYTE, '-'); uint8_2lcd(~number+1);}
+    else          {uint8_2lcd(number);                              }
 }
 
 //-----------------------------------------------------------------------------
@@ -248,11 +434,10 @@ void strobe_lcd(void){
 //                          clear_display
 //
 //Clears entire display and sets DDRAM address 0 in address counter. Requires
-//1.8ms for execution. Use only if you can withstand the big delay.
+//1.8ms for execution, which the queue waits out before the next byte.
 //
 void clear_display(void){
-  send_lcd(CMD_BYTE, CLEAR_DISPLAY);
-  _delay_us(1800);   //1.8ms wait for LCD execution
+  lcd_queue(CMD_BYTE, CLEAR_DISPLAY, 1800);
 }
 
 //-----------------------------------------------------------------------------
@@ -260,12 +445,10 @@ void clear_display(void){
 //
 //Sets DDRAM address 0 in address counter. Also returns display from being
 //shifted to original position.  DDRAM contents remain unchanged. Requires
-//1.5ms to execute. Use only if you can withstand the big delay. Consider
-//using line1_col1().
+//1.5ms to execute, which holds up the queue. Consider using line1_col1().
 //
 void cursor_home(void){
-  send_lcd(CMD_BYTE, RETURN_HOME);
-  _delay_us(1500);  //1.5ms wait for LCD execution
+  lcd_queue(CMD_BYTE, RETURN_HOME, 1500);
   }
 
 //-----------------------------------------------------------------------------
@@ -298,7 +481,6 @@ void fill_spaces(void){
 	uint8_t i;
 	for (i=0; i<=(NUM_LCD_CHARS-1); i++){
 		send_lcd(CHAR_BYTE, ' ');
-                _delay_us(40);  //40us wait between characters
 	}
 }
 
@@ -316,30 +498,55 @@ void char2lcd(char a_char){send_lcd(CHAR_BYTE, a_char);}
 //Send a ascii string to the LCD.
 void string2lcd(char *lcd_str){
   uint8_t i;
-  for (i=0; i<=(strlen(lcd_str)-1); i++){send_lcd(CHAR_BYTE, lcd_str[i]);
-  _delay_us(40);  //execution takes 37us per character
-  }
+  for (i=0; i<=(strlen(lcd_str)-1); i++){send_lcd(CHAR_BYTE, lcd_str[i]);}
+}
+
+//----------------------------------------------------------------------------
+//                            string2lcd_P
+//
+//Send an ascii string held in program memory to the LCD.
+//usage: string2lcd_P(PSTR("hello"));
+//
+void string2lcd_P(const char *lcd_str){
+  char c;
+  while ((c = pgm_read_byte(lcd_str++))) {send_lcd(CHAR_BYTE, c);}
+}
+
+//----------------------------------------------------------------------------
+//                            lcd_fill_P
+//
+//Formats a string held in program memory into a field of "width" chars of a
+//frame such as lcd_update() takes, padding with spaces, so constant text
+//never has to be copied into SRAM first.
+//
+void lcd_fill_P(char *field, const char *text, uint8_t width){
+  char c;
+  while (width && (c = pgm_read_byte(text++))) {*field++ = c; width--;}
+  while (width--) {*field++ = ' ';}
 }
 
 //----------------------------------------------------------------------------
 //                            lcd_init
 //
-//Initalize the LCD
+//Initalize the LCD. In SPI mode the whole sequence, power up delay
+//included, is queued and plays out from TIMER1 once interrupts are on
+//(TIMER1 must already be running).
 //
 void lcd_init(void){
-  _delay_ms(16);      //power up delay
 #if SPI_MODE==1       //assumption is that the SPI port is intialized
   //TODO: kludge alert! setting of DDRF should not be here, but is probably harmless.
   DDRF=0x08;          //port F bit 3 is enable for LCD in SPI mode
-  send_lcd(CMD_BYTE, 0x30); _delay_ms(7); //send cmd sequence 3 times
-  send_lcd(CMD_BYTE, 0x30); _delay_ms(7);
-  send_lcd(CMD_BYTE, 0x30); _delay_ms(7);
-  send_lcd(CMD_BYTE, 0x38); _delay_ms(5);
-  send_lcd(CMD_BYTE, 0x08); _delay_ms(5);
-  send_lcd(CMD_BYTE, 0x01); _delay_ms(5);
-  send_lcd(CMD_BYTE, 0x06); _delay_ms(5);
-  send_lcd(CMD_BYTE, 0x0C + (CURSOR_VISIBLE<<1) + CURSOR_BLINK); _delay_ms(5);
+  lcd_queue(LCD_WAIT, 0, 16000);       //power up delay
+  lcd_queue(CMD_BYTE, 0x30, 7000);     //send cmd sequence 3 times
+  lcd_queue(CMD_BYTE, 0x30, 7000);
+  lcd_queue(CMD_BYTE, 0x30, 7000);
+  lcd_queue(CMD_BYTE, 0x38, 5000);
+  lcd_queue(CMD_BYTE, 0x08, 5000);
+  lcd_queue(CMD_BYTE, 0x01, 5000);
+  lcd_queue(CMD_BYTE, 0x06, 5000);
+  lcd_queue(CMD_BYTE, 0x0C + (CURSOR_VISIBLE<<1) + CURSOR_BLINK, 5000);
 #else //4-bit mode
+  _delay_ms(16);      //power up delay
   LCD_PORT_DDR = 0xF0                    | //initalize data pins
                  ((1<<LCD_CMD_DATA_BIT)  | //initalize control pins
                   (1<<LCD_STROBE_BIT  )  |
@@ -351,11 +558,11 @@ void lcd_init(void){
   LCD_PORT = 0x30; strobe_lcd(); _delay_us(80); //function set,   write lcd, delay > 37us
   LCD_PORT = 0x20; strobe_lcd(); _delay_us(80); //set 4-bit mode, write lcd, delay > 37us
   //continue initalizing the LCD, but in 4-bit mode
-  send_lcd(CMD_BYTE, 0x28); _delay_ms(7); //function set: 4-bit, 2 lines, 5x8 font
+  lcd_queue(CMD_BYTE, 0x28, 7000); //function set: 4-bit, 2 lines, 5x8 font
   //send_lcd(CMD_BYTE, 0x08, 5000);
-  send_lcd(CMD_BYTE, 0x01); _delay_ms(7)  //clear display
-  send_lcd(CMD_BYTE, 0x06);  _delay_ms(5) //cursor moves to right, don't shift display
-  send_lcd(CMD_BYTE, 0x0C | (CURSOR_VISIBLE<<1) | CURSOR_BLINK); _delay_ms(5);
+  lcd_queue(CMD_BYTE, 0x01, 7000); //clear display
+  lcd_queue(CMD_BYTE, 0x06, 5000); //cursor moves to right, don't shift display
+  lcd_queue(CMD_BYTE, 0x0C | (CURSOR_VISIBLE<<1) | CURSOR_BLINK, 5000);
 #endif
 }
 
@@ -416,7 +623,7 @@ void  lcd_int32(int32_t l,          //number to display
       if (bSigned){sline[i++] = '-';}
 
       // now output the formatted number
-      do{send_lcd(CHAR_BYTE, sline[--i]); _delay_us(40);} while(i);
+      do{send_lcd(CHAR_BYTE, sline[--i]);} while(i);
 
 }
 
@@ -490,6 +697,6 @@ void    lcd_int16(int16_t l,
         if (bSigned){sline[i++] = '-';}
 
         // now output the formatted number
-            do{send_lcd(CHAR_BYTE, sline[--i]); _delay_us(40);} while(i);
+            do{send_lcd(CHAR_BYTE, sline[--i]);} while(i);
 }
 
@@ -24,6 +24,8 @@ set cursor position                             0x80+position
 #define RETURN_HOME     0x02
 #define CLEAR_DISPLAY   0x01
 
+#define LCD_ADDR_UNKNOWN 0xFF   //address counter not in DDRAM or not known
+
 #include "stdint.h"
 //assumes timing specified at LCD Vdd=4.4-5.5v
 
@@ -32,6 +34,14 @@ set cursor position                             0x80+position
 
 #define CMD_BYTE  0x00
 #define CHAR_BYTE 0x01
+#define LCD_WAIT  0x02  //lcd_queue() entry that sends nothing, only waits
+
+//The command queue is paced by TIMER1 (CTC, prescale 64), 4us per count.
+//A plain command or character gets LCD_SETTLE_US: 37us to execute, plus
+//the count it may start part way into and the SPI transfer ahead of it.
+#define LCD_COUNT_US    (64000000UL / F_CPU)
+#define LCD_COUNTS(us)  (((us) + LCD_COUNT_US - 1) / LCD_COUNT_US)
+#define LCD_SETTLE_US   48
 
 //The hardware port configuration for 4-bit operation is assumed 
 //to be all on one port.  Control lines are assumed to be in the
@@ -57,6 +67,8 @@ set cursor position                             0x80+position
 #define SPI_MODE          1
 
 void send_lcd(uint8_t cnd_or_char, uint8_t data);
+void lcd_queue(uint8_t type, uint8_t byte, uint16_t settle_us);
+uint8_t lcd_idle(void);
 void send_lcd_8bit(uint8_t cnd_or_char, uint8_t data, uint16_t wait);
 void set_custom_character(uint8_t data[], uint8_t address);
 void set_cursor(uint8_t row, uint8_t col);
@@ -72,11 +84,14 @@ void line1_col1(void);
 void line2_col1(void);      
 void fill_spaces(void);
 void string2lcd(char *lcd_str);
+void string2lcd_P(const char *lcd_str);
+void lcd_fill_P(char *field, const char *text, uint8_t width);
 void strobe_lcd(void);
 void clear_display(void);
 void char2lcd(char a_char);
 void lcd_init(void);
 void refresh_lcd(char const lcd_string_array[]);
+void lcd_update(char const frame[]);
 void lcd_int32(int32_t l, uint8_t fieldwidth, uint8_t decpos, uint8_t bSigned, uint8_t bZeroFill);
 void lcd_int16(int16_t l, uint8_t fieldwidth, uint8_t decpos, uint8_t bZeroFill);
 void set_DDRAM_addr16(void);
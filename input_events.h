@@ -0,0 +1,82 @@
+#ifndef INPUT_EVENTS_H
+#define INPUT_EVENTS_H
+
+#include <stdint.h>
+
+//******************************************************************************
+//                              input events
+//The input ISRs push compact events into a single producer, single consumer
+//ring and input_task drains it from main(). Neither side disables
+//interrupts: the producer alone writes input_head, the consumer alone
+//writes input_tail, and each publishes its index only after the slots it
+//covers are written or read. The TIMER2 ISR (buttons) and the SPI_STC ISR
+//(encoders) both push, but AVR interrupts do not nest, so they are one
+//producer.
+//
+//  what    kind in the high nibble, button number or encoder in the low one
+//  delta   signed steps of an EV_ENCODER event, 0 otherwise
+//******************************************************************************
+#define EV_PRESS    0x00  //debounced press
+#define EV_RELEASE  0x10
+#define EV_LONG     0x20  //held BUTTON_LONG_TICKS
+#define EV_REPEAT   0x30  //still held, every BUTTON_REPEAT_TICKS
+#define EV_ENCODER  0x40
+
+#define EV_KIND(ev) ((ev).what & 0xF0)
+#define EV_ID(ev)   ((ev).what & 0x0F)
+
+#define ENC_LEFT    0     //volume
+#define ENC_RIGHT   1     //time fields and tuning
+
+#define INPUT_RING_SIZE 64 //power of two
+#define INPUT_RING_MASK (INPUT_RING_SIZE - 1)
+
+//keeps the compiler from moving slot accesses across an index update
+#define input_barrier() __asm__ __volatile__("" ::: "memory")
+
+typedef struct {
+	uint8_t what;
+	int8_t  delta;
+} input_event_t;
+
+input_event_t input_ring[INPUT_RING_SIZE];
+volatile uint8_t input_head = 0; //next slot to fill, producer only
+volatile uint8_t input_tail = 0; //next slot to read, consumer only
+volatile uint8_t input_lost = 0; //events dropped on a full ring
+
+//******************************************************************************
+//                              input_push
+//Producer side, from an ISR. A full ring drops the event.
+//******************************************************************************
+void input_push(uint8_t what, int8_t delta) {
+	uint8_t head = input_head;
+	uint8_t next = (head + 1) & INPUT_RING_MASK;
+
+	if (next == input_tail) {input_lost++; return;}
+	input_ring[head].what = what;
+	input_ring[head].delta = delta;
+	input_barrier();
+	input_head = next;
+}
+
+//******************************************************************************
+//                              input_drain
+//Consumer side, from main(). Hands every event queued so far to "handler",
+//oldest first, and frees their slots in one go. Events pushed meanwhile wait
+//for the next call. Returns the number of events handled.
+//******************************************************************************
+uint8_t input_drain(void (*handler)(input_event_t ev)) {
+	uint8_t tail = input_tail;
+	uint8_t head = input_head;
+	uint8_t count = 0;
+
+	input_barrier();
+	for (; tail != head; tail = (tail + 1) & INPUT_RING_MASK, count++) {
+		handler(input_ring[tail]);
+	}
+	input_barrier();
+	input_tail = tail;
+	return count;
+}
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef INPUT_TRACE_H
+#define INPUT_TRACE_H
+
+//******************************************************************************
+//                               input trace
+//Built with DEFS=-DINPUT_TRACE the clock logs its raw inputs to USART0 so a
+//session can be replayed on the host (sim/replay.c). Every TIMER2 tick
+//records the PINA button byte and the encoder nibble read back from the 165.
+//Ticks that repeat the previous inputs are run length coded, so an idle
+//clock costs one byte per 128 ticks.
+//
+//  "L4T3"                 header, sent by trace_init()
+//  0x00-0x7F              the previous inputs again for 1-128 ticks
+//  0x80-0x8F              new encoder nibble (low 4 bits), same PINA
+//  0x90-0x9F  pina        new encoder nibble and PINA
+//  0xF0       lo hi       main() tuned the current band
+//  0xF1                   a second of the clock, taken between two ticks
+//  0xF2       mode s0-s3 ah am lo hi band   checkpoint: clock_mode,
+//                         clock_seconds (low byte first), my_alarm,
+//                         encoder_freq and current_radio_band after the
+//                         last tick
+//  0xF3       lo hi       the radio set encoder_freq: a seek, scan or preset
+//  0xF4       fm am sw    last frequency of each band at reset, lo hi each
+//  0xF5       table       the alarm table at reset, alarms.h
+//  0xFE                   bytes were lost, the trace is no longer exact
+//
+//Bytes are queued in a ring buffer and sent from the UDRE interrupt at
+//57600 baud, which keeps well ahead of a fast turning encoder.
+//trace_init() follows the header with a checkpoint of the state at reset,
+//settings restored from EEPROM included, the frequencies of the other bands
+//and the alarm table, which the replay starts from.
+//Without INPUT_TRACE every hook compiles to nothing.
+//******************************************************************************
+
+#define TRACE_RUN        0x00
+#define TRACE_NIBBLE     0x80
+#define TRACE_PINS       0x90
+#define TRACE_FREQ       0xF0
+#define TRACE_SECOND     0xF1
+#define TRACE_CHECKPOINT 0xF2
+#define TRACE_STATION    0xF3
+#define TRACE_BANDS      0xF4
+#define TRACE_ALARMS     0xF5
+#define TRACE_LOST       0xFE
+
+#ifdef INPUT_TRACE
+
+#include "globals.h"
+#include "clock.h"
+#include "alarms.h"
+
+#define TRACE_BAUD      57600
+#define TRACE_UBRR      ((F_CPU / (TRACE_BAUD * 16UL)) - 1)
+#define TRACE_BUF_SIZE  64   //power of two
+#define TRACE_BUF_MASK  (TRACE_BUF_SIZE - 1)
+
+volatile uint8_t trace_buf[TRACE_BUF_SIZE];
+volatile uint8_t trace_head, trace_tail;
+uint8_t trace_run;               //ticks not yet written out
+uint8_t trace_pins, trace_nibble;
+uint8_t trace_tick_pins;         //PINA of the tick whose encoders are being read
+bool    trace_lost;
+
+//******************************************************************************
+//                              trace_put
+//Queues one byte. Called with interrupts off (from an ISR or inside an atomic
+//block in main). A full ring drops the byte and marks the trace as lossy.
+//******************************************************************************
+void trace_put(uint8_t data) {
+	uint8_t next = (trace_head + 1) & TRACE_BUF_MASK;
+	if (trace_lost) { //try to tell the reader first
+		if (next == trace_tail) return;
+		trace_buf[trace_head] = TRACE_LOST;
+		trace_head = next;
+		next = (trace_head + 1) & TRACE_BUF_MASK;
+		trace_lost = false;
+	}
+	if (next == trace_tail) {trace_lost = true; return;}
+	trace_buf[trace_head] = data;
+	trace_head = next;
+	UCSR0B |= (1 << UDRIE0); //start or keep the transmitter going
+}
+
+//writes out the ticks that repeated the previous inputs
+void trace_flush_run(void) {
+	if (trace_run) {trace_put(TRACE_RUN | (trace_run - 1)); trace_run = 0;}
+}
+
+//the TIMER2 ISR samples the buttons; the encoders arrive later from SPI_STC
+#define trace_buttons(pins) (trace_tick_pins = (pins))
+
+//******************************************************************************
+//                              trace_tick
+//Records the inputs of one TIMER2 tick, once its encoder nibble is in.
+//******************************************************************************
+void trace_tick(uint8_t nibble) {
+	uint8_t pins = trace_tick_pins;
+	if (pins == trace_pins && nibble == trace_nibble) {
+		if (++trace_run == 128) trace_flush_run();
+		return;
+	}
+	trace_flush_run();
+	if (pins == trace_pins) trace_put(TRACE_NIBBLE | nibble);
+	else {trace_put(TRACE_PINS | nibble); trace_put(pins);}
+	trace_pins = pins;
+	trace_nibble = nibble;
+}
+
+//******************************************************************************
+//                            trace_checkpoint
+//Records the state the replay should have reached after the last tick.
+//******************************************************************************
+void trace_checkpoint(void) {
+	trace_flush_run();
+	trace_put(TRACE_CHECKPOINT);
+	trace_put(clock_mode);
+	for (uint8_t i = 0; i < 4; i++) {trace_put((uint8_t)(clock_seconds >> 8 * i));}
+	trace_put(my_alarm.hour);
+	trace_put(my_alarm.minute);
+	trace_put((uint8_t)encoder_freq);
+	trace_put((uint8_t)(encoder_freq >> 8));
+	trace_put(current_radio_band);
+}
+
+//marks the seconds a TIMER0 overflow counted, none, one or two with the
+//drift trim, with a checkpoint once a minute
+void trace_second(uint8_t counted) {
+	if (!counted) return;
+	trace_flush_run();
+	for (uint8_t i = 0; i < counted; i++) trace_put(TRACE_SECOND);
+	if (clock_seconds % 60 < counted) trace_checkpoint(); //past :00
+}
+
+//******************************************************************************
+//                               trace_freq
+//Records the frequency main() hands to the radio, the last frequency of the
+//current band from then on.
+//******************************************************************************
+static void trace_word(uint8_t record, uint16_t value) {
+	uint8_t sreg = SREG;
+	cli();
+	trace_flush_run();
+	trace_put(record);
+	trace_put((uint8_t)value);
+	trace_put((uint8_t)(value >> 8));
+	SREG = sreg;
+}
+
+void trace_freq(uint16_t freq) {
+	trace_word(TRACE_FREQ, freq);
+}
+
+//the frequency a seek, scan or preset chose, which the inputs alone do not
+//tell
+void trace_station(uint16_t freq) {
+	trace_word(TRACE_STATION, freq);
+}
+
+//******************************************************************************
+//                               trace_init
+//USART0 transmitter only, 8N1. The first tick is always written out in full.
+//******************************************************************************
+void trace_init(void) {
+	UBRR0H = (uint8_t)(TRACE_UBRR >> 8);
+	UBRR0L = (uint8_t)TRACE_UBRR;
+	UCSR0C = (1 << UCSZ01) | (1 << UCSZ00);
+	UCSR0B = (1 << TXEN0);
+	trace_pins = 0x00;     //the replay starts from the same inputs
+	trace_nibble = 0x10;   //not a nibble, so the first tick is written
+	trace_put('L'); trace_put('4'); trace_put('T'); trace_put('3');
+	trace_checkpoint(); //the state the replay starts from
+	trace_put(TRACE_BANDS);  //what a band change goes back to
+	trace_put((uint8_t)current_fm_freq); trace_put((uint8_t)(current_fm_freq >> 8));
+	trace_put((uint8_t)current_am_freq); trace_put((uint8_t)(current_am_freq >> 8));
+	trace_put((uint8_t)current_sw_freq); trace_put((uint8_t)(current_sw_freq >> 8));
+	trace_put(TRACE_ALARMS); //what ALARM_MODE shows
+	for (uint8_t i = 0; i < sizeof(alarms); i++) {trace_put(((const uint8_t *)alarms)[i]);}
+}
+
+ISR(USART0_UDRE_vect) {
+	if (trace_tail == trace_head) {UCSR0B &= ~(1 << UDRIE0); return;}
+	UDR0 = trace_buf[trace_tail];
+	trace_tail = (trace_tail + 1) & TRACE_BUF_MASK;
+}
+
+#else
+
+#define trace_init()
+#define trace_buttons(pins)
+#define trace_tick(nibble)
+#define trace_second(counted) ((void)(counted))
+#define trace_checkpoint()
+#define trace_freq(freq)
+#define trace_station(freq)
+
+#endif
+
+#endif
@@ -13,7 +13,10 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/pgmspace.h>
 #include <util/delay.h>
+#include <util/twi.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
@@ -25,57 +28,63 @@
 #include "seven_seg.h"
 #include "encoders.h"
 #include "globals.h"
+#include "frame.h"
 #include "check_buttons.h"
+#include "input_events.h"
+#include "input_trace.h"
+#include "scheduler.h"
+#include "spi.h"
 #include "lm73_functions.h"
 #include "twi_master.h"
 #include "si4734.h"
+#include "radio.h"
+#include "clock.h"
+#include "alarms.h"
+#include "settings.h"
 
 #define clr_bit(x, y) (x&=~(1<<y)); //clears a bit
 #define set_bit(x, y) (x|=(1<<y));  //sets a bit 
+#ifndef TEMP_FAHRENHEIT
+#define TEMP_FAHRENHEIT 0 //1 shows the LM73 in degrees F, e.g. DEFS=-DTEMP_FAHRENHEIT=1
+#endif
 
+//index of each task in tasks[], highest priority first
+enum {TASK_INPUT, TASK_DISPLAY, TASK_LCD, TASK_TEMP, TASK_RADIO, TASK_SETTINGS};
+
+
+//TWI callback of the LM73 read: the reading is in lm73_rd_buf
+void lm73_done(uint8_t status) {
+	if (!status) {task_post(TASK_TEMP);} //format the temperature
+}
 
 //******************************************************************************/
 //                           timer/counter0 ISR                          
-//When the TCNT0 overflow occurs the second is incremented. If 60 seconds is
-//hit the clock rolls over and one minute is added. Likewise, if 60 minutes is
-//hit the clock rolls over and the hour increments. This function is also
-//responsible for flashing the colon every second. 
+//When the TCNT0 overflow occurs the second is counted, trimmed for the drift
+//of the crystal (clock_tick(), clock.h).
+//This function is also responsible for flashing the colon every second and
+//queues the LM73 read and next one shot conversion, which share the bus with
+//the radio without waiting for it.
 //******************************************************************************/
 
 ISR(TIMER0_OVF_vect) {
 	static uint8_t j = 0;
+	uint8_t counted = clock_tick();
 
-	my_time.second++; 
-	if (my_time.second > 59) { //add one minute
-		my_time.minute++;
-		if (my_time.minute > 59) { //roll over minutes and add one hour
-			my_time.hour++;
-			my_time.minute = 0;
-		}
-		my_time.second = 0; //roll over seconds
-	}
-
-	if (my_alarm.minute > 59) {
-		my_alarm.hour++;
-		my_alarm.minute = 0;
-	}
-
-	if (snooze_count > 0) {snooze_count--;}
+	trace_second(counted);
 
 	//Blink the colon when not in RADIO_MODE
 	if (clock_mode != RADIO_MODE) {
 		if (j == 0)
-			segment_data[2] = dec_to_7seg[11]; //colon is illuminated
+			segment_data[2] = seg_code(11); //colon is illuminated
 		else
-			segment_data[2] = dec_to_7seg[10]; //colon is off
+			segment_data[2] = seg_code(10); //colon is off
 		j++; 
 
 		if (j > 1) {j = 0;}
 
 		alarm_toggle = !alarm_toggle; //toggle alarm sound each second
-
-		twi_start_rd(LM73_ADDRESS, lm73_rd_buf, 2);
 	}
+	lm73_sample(lm73_done); //skipped if the queue is full
 }//ISR
 
 //******************************************************************************/
@@ -95,128 +104,359 @@ ISR(TIMER1_COMPA_vect) {
 //******************************************************************************/
 //																alarm_handler	
 //This function handles what occurs when the user selects the alarm to be armed. 
-//It takes in a bool called alarm_armed and depending on the global snooze_count
-//variable will display on the LCD that the alarm is on. If the alarm time and
-//the clock time are the same, the disply changes and the alarm_engaged boolean
-//is set true, which enables PORTD bit 5 to output.
+//It takes in a bool called alarm_armed and will display on the LCD that the
+//alarm is on. When the clock reaches the next alarm of the table (alarms.h),
+//the one comparison made on every tick, the disply changes and the
+//alarm_engaged boolean is set true for that minute, which enables PORTD bit 5
+//to output. Once the minute is over the alarm after it is looked up.
 //******************************************************************************/
 void alarm_handler(bool alarm_armed) {
-	if (alarm_armed && snooze_count == 0) {
-		strcpy(alarm_array, "ALARM:ON");
-		if (
-				my_alarm.hour == my_time.hour &&
-				my_alarm.minute == my_time.minute
-			 ) {
-			strcpy(alarm_array, "TIME TO RISE");
+	if (clock_calendar()->week_minute == alarm_next) {
+		alarm_fired = true;
+		if (alarm_armed) {
+			alarm_text = PSTR("TIME TO RISE");
 			alarm_engaged = true;
 			return;
 		}
 	}
+	else if (alarm_fired) {alarm_schedule();} //its minute is over
+	if (alarm_armed && clock_mode == TIME_MODE) {alarm_text = PSTR("ALARM:ON");}
 	alarm_engaged = false;
 }
 
 
 //******************************************************************************/
-//                           timer/counter2 ISR                          
-//When the TCNT2 overflow interrupt occurs, the count_7ms variable is    
-//incremented. Every 7680 interrupts the minutes counter is incremented.
-//TCNT0 interrupts come at 7.8125ms internals. write to bg, read from encoders
-// 1/32768         = 30.517578uS
-//(1/32768)*256    = 7.8125ms
-//(1/32768)*256*64 = 500mS
+//                              time_step
+//One step of the selected field from the encoder or a held button, keeping
+//the time in range both ways. The clock is stepped through a copy of its
+//hour and minute, which then moves the count; the date stays. A new time or
+//alarm moves the next alarm.
 //******************************************************************************/
-ISR(TIMER2_OVF_vect) {
-	static uint8_t encoder = 0; //stores current encoder state value (11, 10, 00, 01)
-	static uint8_t past_encoder = 0; //stores previous encoder state value
-	static uint8_t j = 0; //segment display variable
-	static bool alarm_armed = false; //used to set arming
+static void time_step(int8_t step) {
+	Time t;
 
-	//Load data from the encoders
-	clr_bit(PORTE, PE6); //load data in the 165
-	set_bit(PORTE, PE6); //shift data out the 165
+	if (clock_mode == ALARM_MODE) {t = my_alarm;}
+	else if (clock_mode == TIME_MODE) {
+		const calendar_t *c = clock_calendar();
+		t = (Time){c->second, c->minute, c->hour};
+	}
+	else {time_adjust(NULL, step); return;} //the radio
+	time_adjust(&t, step);
+	if (t.hour > 23) {t.hour = step > 0 ? 0 : 23;}
+	if (t.minute > 59) {t.minute = step > 0 ? 0 : 59;}
+	if (clock_mode == ALARM_MODE) {
+		my_alarm = t;
+		alarm_store();
+	}
+	else {
+		clock_set_time(t.hour, t.minute);
+		alarm_schedule();
+	}
+}
 
-	DDRA = 0x00;  //intitialize PORTA to inputs
-	PORTA = 0xFF; //enable pull-ups
-	PORTB = 0x70;
+//******************************************************************************/
+//                              button_sample
+//Debounces all eight buttons once per TIMER2 tick (PORTA must be set to
+//inputs with pull-ups) and pushes their events to the input ring.
+//******************************************************************************/
+static void button_push(uint8_t mask, uint8_t kind) {
+	for (uint8_t i = 0; mask; i++, mask >>= 1) {
+		if (mask & 1) {input_push(kind | i, 0);}
+	}
+}
 
-	//Check the buttons
-	for(uint8_t i=0; i < 8; i++) {
-		if(chk_buttons(i)) { //if button is pressed
-			switch(i) { //cases for buttons pressed
-				case 1: time = TIME_SELECT_HOUR; //choose hour using right encoder
-								break;
-				case 2: time = TIME_SELECT_MINUTE; //choose minute using right encoder
-								break;
-				case 3: clock_mode = (
-										(clock_mode == TIME_MODE)
-										? RADIO_MODE
-										: TIME_MODE
-										);
-								clear_display();
-								break;
-				case 5: if (clock_mode != SNOOZE_MODE) { //set snooze mode
-									clock_mode = SNOOZE_MODE;
-									snooze_count = 10;
-								}
-								else {
-									clock_mode = TIME_MODE; //else enter time mode
-									snooze_count = 0;
-								}
-								break;
-				case 6: alarm_armed = !alarm_armed; //toggle arming the alarm
-								break;
-				case 7: clock_mode = ( //ternary for mode selection
-										(clock_mode == TIME_MODE)
-										? ALARM_MODE
-										: TIME_MODE
-										);
-								clear_display();	
-								break;
-			}//switch
-		}//if			
-	}//for
+void button_sample(void) {
+	chk_buttons(~PINA);
+	if (button_press | button_release | button_long | button_repeat) {
+		button_push(button_press, EV_PRESS);
+		button_push(button_release, EV_RELEASE);
+		button_push(button_long, EV_LONG);
+		button_push(button_repeat, EV_REPEAT);
+	}
+}
+
+//******************************************************************************/
+//                              button_handler
+//Acts on one button event: time selection, mode changes, snooze and arming
+//the alarm on a press. Holding the hour or minute select button steps that
+//field, first on the long press, then on every repeat.
+//
+//In RADIO_MODE buttons 1 and 2 seek down and up instead. Buttons 0 and 4
+//act on the release: a short press steps to the previous and next preset,
+//while holding 0 changes the band, FM, AM, SW, and holding 4 scans the band
+//for a new station index.
+//
+//In ALARM_MODE button 4 steps to the next alarm of the table, 0 steps its
+//weekdays (every day, weekdays, weekends) and 6 enables or disables it
+//rather than arming all of them. In TIME_MODE buttons 0 and 4 move the date
+//a day back and on. The date is set only here; without it an alarm weekday
+//would count from the power-up date, 2000-01-01 (SAT 01), not the real week.
+//******************************************************************************/
+void button_handler(uint8_t kind, uint8_t button) {
+	static uint8_t held_long = 0; //buttons whose long press was used
 
+	if (kind == EV_LONG || kind == EV_REPEAT) {
+		if (clock_mode == RADIO_MODE) {
+			if (kind == EV_LONG && button == 0) {held_long |= 1 << 0; radio_band_next();}
+			if (kind == EV_LONG && button == 4) {held_long |= 1 << 4; radio_seek(SEEK_SCAN);}
+		}
+		else if (BUTTON_REPEAT_MASK & (1 << button)) {time_step(1);} //press selected the field
+		return;
+	}
+	if (kind == EV_RELEASE) {
+		if (clock_mode == RADIO_MODE && (button == 0 || button == 4) && !(held_long & (1 << button))) {
+			radio_preset(button ? 1 : -1);
+		}
+		held_long &= ~(1 << button);
+		return;
+	}
+	if (kind != EV_PRESS) {return;}
+
+	if (clock_mode == RADIO_MODE) {
+		switch (button) {
+			case 1: radio_seek(SEEK_DOWN); return;
+			case 2: radio_seek(SEEK_UP); return;
+		}
+	}
+	if (clock_mode == TIME_MODE && (button == 0 || button == 4)) {
+		clock_day_step(button ? 1 : -1);
+		alarm_schedule();
+		return;
+	}
+	if (clock_mode == ALARM_MODE) {
+		switch (button) {
+			case 0: alarm_days_next(); return;
+			case 4: alarm_select_next(); return;
+			case 6: alarm_enable_toggle(); return;
+		}
+	}
+
+	switch(button) { //cases for buttons pressed
+		case 1: time = TIME_SELECT_HOUR; //choose hour using right encoder
+						break;
+		case 2: time = TIME_SELECT_MINUTE; //choose minute using right encoder
+						break;
+		case 3: clock_mode = (
+								(clock_mode == TIME_MODE)
+								? RADIO_MODE
+								: TIME_MODE
+								);
+						clear_display();
+						break;
+		case 5: if (clock_mode != SNOOZE_MODE) { //set snooze mode
+							clock_mode = SNOOZE_MODE;
+							alarm_snooze(); //rings again after the alarm's snooze length
+						}
+						else {
+							clock_mode = TIME_MODE; //else enter time mode
+							alarm_snooze_end();
+						}
+						break;
+		case 6: alarm_armed = !alarm_armed; //toggle arming the alarm
+						break;
+		case 7: clock_mode = ( //ternary for mode selection
+								(clock_mode == TIME_MODE)
+								? ALARM_MODE
+								: TIME_MODE
+								);
+						alarm_load();
+						clear_display();	
+						break;
+	}//switch
+}
+
+//******************************************************************************/
+//                              encoder_handler
+//Applies one encoder event: the left encoder sets the volume, the right one
+//steps the selected field one unit at a time, keeping the time in range.
+//******************************************************************************/
+void encoder_handler(uint8_t encoder, int8_t delta) {
+	if (encoder == ENC_LEFT) {volume_adjust(delta); return;}
+	for (; delta > 0; delta--) {time_step(1);}
+	for (; delta < 0; delta++) {time_step(-1);}
+}
+
+//******************************************************************************/
+//                              ui_event
+//The UI state machine: every input event goes through here, from
+//input_task in main(), never from an ISR.
+//******************************************************************************/
+void ui_event(input_event_t ev) {
+	if (EV_KIND(ev) == EV_ENCODER) {encoder_handler(EV_ID(ev), ev.delta);}
+	else {button_handler(EV_KIND(ev), EV_ID(ev));}
+}
+
+//******************************************************************************/
+//                                 tasks
+//Everything the TIMER2 ISR used to do besides sampling the inputs and
+//multiplexing the digits runs here, from main(), through the scheduler.
+//The table is in priority order; period and deadline are in TIMER2 ticks
+//of 1.024 ms.
+//******************************************************************************/
+//the input events the ISRs pushed since the last run, in one batch
+void input_task(void) {
+	input_drain(ui_event);
+}
+
+//mode dependent 7-seg value and LCD line 1
+void display_task(void) {
+	static const char *shown_text = NULL;
+	static uint16_t shown_freq = 0, freq_digits;
+	static uint16_t shown_alarm = 0xFFFF; //alarm_shown() of the composed line
+	static uint8_t shown_day = 0;         //day of the month on the line, 0 for none
+	const calendar_t *now = clock_calendar();
+	bool dated;
+
+	disp_second = now->second; //for the bar graph
 	switch (clock_mode) {
 		case ALARM_MODE: //display the alarm time
-			disp_value = (my_alarm.hour * 100) + my_alarm.minute;
-		  strcpy(alarm_array, "SET ALARM"); //write to LCD display
+			disp_value = time_to_bcd(my_alarm.hour, my_alarm.minute);
+			alarm_text = NULL; //the alarm being set, composed below
 			break;
 		case TIME_MODE: //display the time
-			disp_value = (my_time.hour * 100) + my_time.minute;
-			strcpy(alarm_array, "ALARM:OFF"); //write to LCD display
+			disp_value = time_to_bcd(now->hour, now->minute);
+			alarm_text = PSTR("ALARM:OFF"); //write to LCD display
 			break;
 		case SNOOZE_MODE: //set snooze
 			alarm_engaged = false;
-			strcpy(alarm_array, "SNOOZE");
+			alarm_text = PSTR("SNOOZE");
 			break;
 		case RADIO_MODE:
-		  segment_data[2] = dec_to_7seg[10];	
-			disp_value = encoder_freq/10; //shift to rid display of trailing zero
-			strcpy(alarm_array, "RADIO ON");
+		  segment_data[2] = seg_code(10);	
+			if (encoder_freq != shown_freq) { //recount the digits only on a change
+				//drops the trailing zero; AM is in kHz and shows them all
+				freq_digits = freq_to_bcd(current_radio_band == AM ? encoder_freq * 10 : encoder_freq);
+				shown_freq = encoder_freq;
+			}
+			disp_value = freq_digits;
+			alarm_text = radio_seeking == SEEK_SCAN ? PSTR("SCANNING")
+			           : radio_seeking != SEEK_NONE ? PSTR("SEEKING")
+			           : radio_failed_out() ? PSTR("RADIO FAIL")
+			           : current_radio_band == AM ? PSTR("RADIO AM")
+			           : current_radio_band == SW ? PSTR("RADIO SW")
+			           : PSTR("RADIO FM");
 			break;
 		default: break;
 	} //switch
 
 	alarm_handler(alarm_armed); //handle the alarm functionality
+	segsum(disp_value); //call segsum
+	dated = clock_mode == TIME_MODE && !alarm_engaged; //the weekday goes after the alarm state
+
+	//the texts are constants, so a new pointer is a new text
+	if (!alarm_text) { //ALARM_MODE, composed only when the alarm or its setup changes
+		if (shown_text || alarm_shown() != shown_alarm) {
+			char line[17];
+			alarm_describe(line);
+			frame_line(frame_edit(), line);
+			frame_publish();
+			shown_alarm = alarm_shown();
+			shown_text = NULL;
+		}
+	}
+	else if (alarm_text != shown_text || (dated && now->day != shown_day)) {
+		char *line = frame_edit();
+
+		frame_line_P(line, alarm_text);
+		shown_day = 0;
+		if (dated) { //e.g. "ALARM:OFF SAT 01"
+			char day[7];
+			clock_day_text(day);
+			memcpy(&line[10], day, 6);
+			shown_day = now->day;
+		}
+		frame_publish();
+		shown_text = alarm_text;
+	}
+}
 
-	SPDR = my_time.second; //shift seconds (will display on bar graph)
-	while (bit_is_clear(SPSR, SPIF)){} //wait until the end of the load
-	PORTB |= 0x01;  //rising edge for ss_n pin on 595
-	PORTB &= ~0x01; //falling edge for ss_n pin on 595
+//queues the cells of the frame that changed since the last tick; while the
+//LCD is still busy with earlier bytes (lcd_init, a clear) it waits a tick
+void lcd_task(void) {
+	if (lcd_idle()) {lcd_update(frame_front());}
+}
 
-	//Shift data from MISO into SPDR
-	encoder = SPDR; //set encoder equal to the SPI data register
-	encoder &= (0x0F); //set all encoder bits (3:0) high
+//posted by lm73_done() each second: filters the new LM73 reading and shows
+//it on LCD line 2 when the tenth of a degree shown changes, which also
+//retrims the clock for the crystal's drift at that temperature (clock.h)
+void temp_task(void) {
+	static bool shown = false;
+	char digits[LM73_TEMP_DIGITS];
+	char temperature[17]; //16 columns, "IN:" and "OUT: :[" leave 4 for the digits
+	int16_t tenths;
+
+	lm73_temp = lm73_filter((uint16_t)lm73_rd_buf[0] << 8 | lm73_rd_buf[1]);
+	tenths = lm73_tenths(lm73_temp, TEMP_FAHRENHEIT);
+	if (shown && tenths == disp_temp) {return;}
+	disp_temp = tenths;
+	shown = true;
+	clock_trim(clock_drift((int16_t)lm73_temp));
+	lm73_temp_convert(digits, lm73_temp, TEMP_FAHRENHEIT);
+	snprintf_P(temperature, sizeof(temperature), PSTR("IN:%s%c\xDFOUT: :["), digits,
+	           TEMP_FAHRENHEIT ? 'F' : 'C');
+	frame_line(frame_edit() + 16, temperature); //pads with spaces
+	frame_publish();
+}
 
-	segsum(disp_value); //call segsum
-	//Encoder values are stored in 4 bits. The upper two bits are for the
-	//right encoder and the lower two are for the left. 
-	right_encoder((past_encoder & 0x0C) >> 2, (encoder & 0x0C) >> 2);
-	left_encoder((past_encoder & 0x03), (encoder & 0x03));
+//powers the radio up or down on mode changes and retunes it once the
+//knob settles, see radio.h
+void radio_task(void) {
+	radio_control();
+}
+
+//saves changed settings to the EEPROM journal once they are left alone,
+//see settings.h
+void settings_task(void) {
+	settings_poll();
+}
 
-	if (my_time.hour > 24) {my_time.hour = 0;}
-	if (my_time.minute > 59) {my_time.minute = 0;}
-	past_encoder = encoder; //remember current state for next interrupt
+task_t tasks[] = {
+	//run           period deadline
+	{input_task,      1,    2},
+	{display_task,    1,    8},
+	{lcd_task,        1,    8},
+	{temp_task,       0,  100},
+	{radio_task,     10,   20},
+	{settings_task,  10,   50},
+};
+const uint8_t num_tasks = sizeof(tasks) / sizeof(tasks[0]);
+
+//******************************************************************************/
+//                              encoder_read
+//SPI_STC callback of the TIMER2 ISR's transfer: the byte shifted in from the
+//165 while the bar graph byte went out.
+//******************************************************************************/
+void encoder_read(uint8_t rx) {
+	uint8_t encoder = rx & 0x0F; //encoder bits (3:0)
+
+	trace_tick(encoder);
+	encoder_sample(encoder);
+}
+
+//******************************************************************************/
+//                           timer/counter2 ISR                          
+//Every 1.024 ms: advances the scheduler time base and posts the periodic
+//tasks, runs the radio command deadlines, samples the buttons, queues the
+//bar graph write and encoder read as one SPI job and multiplexes the next
+//7-segment digit. The rest of the work is done by the tasks above and
+//encoder_read().
+//******************************************************************************/
+ISR(TIMER2_OVF_vect) {
+	static uint8_t j = 0; //segment display variable
+
+	sched_tick();
+	si4734_tick(); //radio command deadlines
+
+	DDRA = 0x00;  //intitialize PORTA to inputs
+	PORTA = 0xFF; //enable pull-ups
+	PORTB = 0x70;
+
+	button_sample(); //check the buttons
+	trace_buttons(PINA); //buttons are still inputs here
+
+	//load the 165, shift seconds out to the bar graph and the encoders in,
+	//then latch the 595
+	spi_queue(disp_second, 0, 1, SPI_LOAD_165 | SPI_LATCH_595, encoder_read);
 
 	//Loop through segments
 	if (j > 4) {j = 0;}
@@ -224,10 +464,6 @@ ISR(TIMER2_OVF_vect) {
 	PORTA = segment_data[j];
 	PORTB = (j << 4);
 	j++;
-
-	strncpy(temp_in_display, temperature, 16);
-	strncpy(alarm_display, alarm_array, 16);
-	refresh_lcd(lcd_string_array);
 }//ISR
 
 //******************************************************************************/
@@ -259,7 +495,7 @@ ISR(ADC_vect) {
 //******************************************************************************/
 //																	ISR(INT7_vect)
 //******************************************************************************/
-ISR(INT7_vect) {STC_interrupt = TRUE;}
+ISR(INT7_vect) {si4734_stc();} //seek/tune complete
 //******************************************************************************/
 //                                main                                 
 //******************************************************************************/
@@ -277,38 +513,20 @@ int main(){
 	lcd_init(); 
 	init_twi();	
 	radio_init();
+	settings_load(); //after tcnt3_init, as it restores the volume
+	station_load();
+	alarm_schedule(); //the first alarm, after settings_load
+	trace_init();
 
 	//enable interrupts
 	sei();
+	spi_irq_enable(); //SPI transfers complete from SPI_STC from here on
 
-	//Fire up the radio
-	fm_pwr_up();
-	current_fm_freq = encoder_freq;
-	fm_tune_freq();
-
-	twi_start_wr(LM73_ADDRESS, lm73_wr_buf, 1);
+	//the radio is powered up by radio_task on entering RADIO_MODE
+	lm73_init(); //one shot conversions at full resolution
 	//radio_pwr_dwn();
 
 	while(1){
-		lm73_temp = lm73_rd_buf[0];   //Read in 16-bit temperature data
-		lm73_temp = (lm73_temp << 8); 
-		lm73_temp |= lm73_rd_buf[1];
-		disp_temp = (lm73_temp/128);  //convert to celcius value to be displayed
-		sprintf(temperature, "IN:%dC\xDFOUT: :[", disp_temp);
-		end_of_string = strlen(temperature); 
-
-		
-    //Place spaces in empty index
-		for (uint8_t i = end_of_string; i < 16; i++)
-			temperature[i] = ' ';
-
-    //
-		if (clock_mode == RADIO_MODE) {
-			fm_pwr_up();
-			current_fm_freq = encoder_freq;
-			fm_tune_freq();
-			_delay_ms(100);
-		}
-		if (clock_mode != RADIO_MODE) {radio_pwr_dwn();}
-	} //empty main while loop
+		if (!sched_run()) {sleep_mode();} //idle until the next interrupt
+	} //main while loop
 } //main
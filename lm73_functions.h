@@ -17,7 +17,14 @@
 #define LM73_PTR_CTRL_STATUS   0x04          //LM73 control and status register
 #define LM73_CONFIG_VALUE0     0x60          //no pwr dwn, disbl alert, no one shot: config reg
 #define LM73_CONFIG_VALUE1     0xE0          //no timeout, max resolution: for ctl/status reg
+#define LM73_CONFIG_PWR_DWN    0x80          //config reg: shut down between conversions
+#define LM73_CONFIG_ONE_SHOT   0x04          //config reg: one conversion while shut down
+#define LM73_TEMP_DIGITS       5             //"-3.0", "-40" or "302" and the NUL
 
 //special functions for lm73 temperature sensor
+void     lm73_init(void);
+uint8_t  lm73_sample(twi_done_t done);
+uint16_t lm73_filter(uint16_t lm73_temp);
+int16_t  lm73_tenths(uint16_t lm73_temp, uint8_t f_not_c);
 uint8_t  lm73_temp_convert(char temp_digits[], uint16_t lm73_temp, uint8_t f_not_c);
   
@@ -1,23 +1,119 @@
 // lm73_functions.c       
 // Roger Traylor 11.28.10
+//
+//The LM73 runs shut down at its highest resolution (0.03125 C, 14 bits) and
+//converts once a second on a one shot: lm73_sample() reads the result of
+//the last conversion and starts the next one, which is ready long before
+//the next second (14 bit conversions take at most 112ms). Readings are
+//averaged by lm73_filter() and converted in fixed point, tenths of a degree,
+//without floats.
 
+#include <stddef.h>
+#include <avr/interrupt.h>
 #include <util/twi.h>
 #include "lm73_functions.h"
 #include <util/delay.h>
 
-volatile uint8_t lm73_wr_buf[2];
 volatile uint8_t lm73_rd_buf[2];
 
+//the transfers are queued, so their bytes live here rather than on the stack
+static uint8_t lm73_res_cmd[2]  = {LM73_PTR_CTRL_STATUS, LM73_CONFIG_VALUE1};
+static uint8_t lm73_shot_cmd[2] = {LM73_PTR_CONFIG,
+                                   LM73_CONFIG_VALUE0 | LM73_CONFIG_PWR_DWN | LM73_CONFIG_ONE_SHOT};
+static uint8_t lm73_temp_ptr[1] = {LM73_PTR_TEMP};
+
+//********************************************************************************
+//                            lm73_init()
+//
+//Sets the resolution and starts the first one shot conversion. Queued, so it
+//needs interrupts on to go out.
+//
+void lm73_init(void){
+  twi_queue(LM73_WRITE, lm73_res_cmd, 2, NULL);
+  twi_queue(LM73_WRITE, lm73_shot_cmd, 2, NULL);
+}
+
+//********************************************************************************
+//                            lm73_sample()
+//
+//From the TIMER0 ISR once a second: points the LM73 at the temperature, reads
+//it into lm73_rd_buf, with "done" called once it is in, and starts the next
+//conversion. The three transfers are queued together or not at all: returns
+//0, and skips this second's sample, if the TWI queue had no room for them.
+//
+uint8_t lm73_sample(twi_done_t done){
+  uint8_t sreg = SREG;
+
+  cli(); //nothing may take the room between the check and the queueing
+  if (twi_room() < 3) {
+    SREG = sreg;
+    return 0;
+  }
+  twi_queue(LM73_WRITE, lm73_temp_ptr, 1, NULL);
+  twi_queue(LM73_READ, (uint8_t *)lm73_rd_buf, 2, done);
+  twi_queue(LM73_WRITE, lm73_shot_cmd, 2, NULL); //the next second's reading
+  SREG = sreg;
+  return 1;
+}
+
 //********************************************************************************
+//                            lm73_filter()
+//
+//Exponential average of the readings, each new one weighted 1/4, so a single
+//noisy conversion moves the display by at most a quarter of its error. The
+//average is kept in quarter counts so it does not drift by truncation. The
+//first reading seeds it.
+//
+uint16_t lm73_filter(uint16_t lm73_temp){
+  static int32_t avg4;      //average, times 4
+  static uint8_t seeded = FALSE;
+
+  if (!seeded) {avg4 = (int32_t)(int16_t)lm73_temp * 4; seeded = TRUE;}
+  else {avg4 += (int16_t)lm73_temp - ((avg4 + 2) >> 2);}
+  return (uint16_t)(int16_t)((avg4 + 2) >> 2);
+}
+
+//********************************************************************************
+//                            lm73_tenths()
+//
+//A reading is two's complement in 1/128 C. Tenths of a degree C are then
+//reading * 10/128 = reading * 5/64, and tenths of a degree F are
+//reading * 9/64 + 320, both rounded to nearest by a shift.
+//
+int16_t lm73_tenths(uint16_t lm73_temp, uint8_t f_not_c){
+  int32_t t = (int16_t)lm73_temp;
+
+  if (f_not_c) {return (int16_t)((t * 9 + 32) >> 6) + 320;}
+  return (int16_t)((t * 5 + 32) >> 6);
+}
 
 //******************************************************************************
-//uint8_t lm73_temp_convert(char temp_digits[], uint16_t lm73_temp, uint8_t f_not_c){
+//                            lm73_temp_convert()
+//
 //given a temperature reading from an LM73, the address of a buffer
 //array, and a format (deg F or C) it formats the temperature into ascii in 
-//the buffer pointed to by the arguement.
-//TODO:Returns what???(uint8_t)??? Probably a BUG?
-
-//Yeah, this is for you to do! ;^)
+//the buffer pointed to by the arguement, in at most four characters: with
+//one decimal where it fits, "22.5", "-3.0", else rounded to whole degrees,
+//"-12", "104". The buffer needs LM73_TEMP_DIGITS chars. Returns the length
+//of the text.
+//
+uint8_t lm73_temp_convert(char temp_digits[], uint16_t lm73_temp, uint8_t f_not_c){
+  int16_t tenths = lm73_tenths(lm73_temp, f_not_c);
+  uint16_t whole;
+  uint8_t n = 0, decimal;
 
-//}//lm73_temp_convert
+  if (tenths < 0) {temp_digits[n++] = '-'; tenths = -tenths;}
+  whole = tenths / 10;
+  decimal = whole < (n ? 10 : 100); //room for the tenth
+  if (!decimal) {whole = (tenths + 5) / 10;}
+  if (whole >= 100) {temp_digits[n++] = '0' + whole / 100;}
+  if (whole >= 10)  {temp_digits[n++] = '0' + whole / 10 % 10;}
+  temp_digits[n++] = '0' + whole % 10;
+  if (decimal) {
+    temp_digits[n++] = '.';
+    temp_digits[n++] = '0' + tenths % 10;
+  }
+  temp_digits[n] = '\0';
+  return n;
+}//lm73_temp_convert
 //******************************************************************************
@@ -0,0 +1,253 @@
+#ifndef RADIO_H
+#define RADIO_H
+
+#include "globals.h"
+#include "si4734.h"
+#include "scheduler.h"
+#include "input_trace.h"
+#include "stations.h"
+
+//******************************************************************************
+//                              radio control
+//Keeps the Si4734 in step with the clock: powered up once when RADIO_MODE is
+//entered, retuned only when encoder_freq changed and then held still for
+//RADIO_SETTLE_TICKS, powered down once when the mode is left.
+//radio_control() runs from radio_task; the si4734 callbacks move the power
+//state on from interrupt context. A failed power up or tune is retried
+//after RADIO_RETRY_TICKS, twice that after a second failure, up to
+//RADIO_TRIES in all; then the radio gives up and shows RADIO FAIL until the
+//knob picks another frequency, after a tune, or RADIO_MODE is entered again.
+//
+//Seeks and the band scan run as chains of si4734 commands whose callbacks
+//queue the next command, so a scan of the whole band is one request from
+//the UI and no task waits on it. radio_control() applies the result once
+//the chain ends. Presets jump straight to a station of the index
+//(stations.h) without the settle time.
+//
+//A band change between AM and SW keeps the chip powered, as both run on its
+//AM receiver: only the properties that differ between the two band profiles
+//are sent (si4734.c), then the tune. FM and AM are separate power up modes
+//of the chip, so a change to or from FM still powers down and up. Each band
+//comes back on its last frequency, kept in RAM.
+//******************************************************************************
+#define RADIO_SETTLE_TICKS 150 //knob still for 150 ms before a retune
+#define RADIO_RETRY_TICKS  250 //before the first retry, doubled for each next
+#define RADIO_TRIES        3   //power ups or tunes in a row before giving up
+
+typedef enum {RADIO_OFF, RADIO_STARTING, RADIO_ON, RADIO_STOPPING} RadioPower;
+typedef enum {SEEK_NONE, SEEK_DOWN, SEEK_UP, SEEK_SCAN} RadioSeek;
+
+volatile RadioPower radio_power = RADIO_OFF;
+enum radio_band radio_powered_band; //band of the last power up
+volatile uint16_t radio_tuned_freq = 0; //last tune sent, 0 for none
+volatile bool radio_tuning = false;
+volatile uint8_t radio_failures = 0;    //power ups or tunes failed in a row
+static volatile uint16_t radio_failed_at; //tick of the last failure
+RadioSeek radio_seek_req = SEEK_NONE;         //asked for by the UI
+volatile RadioSeek radio_seeking = SEEK_NONE; //under way
+volatile uint16_t radio_found;                //where it ended, 0 if it failed
+volatile bool radio_seek_done = false;        //for radio_control() to pick up
+bool radio_jump = false;                      //tune without the settle time
+
+//counts a failed power up or tune, or clears the count on a success
+static void radio_result(uint8_t status) {
+	if (!status) {radio_failures = 0; return;}
+	radio_failures++;
+	radio_failed_at = sched_now();
+}
+
+static void radio_up_done(uint8_t status) {
+	radio_result(status);
+	radio_power = status ? RADIO_OFF : RADIO_ON;
+}
+
+static void radio_down_done(uint8_t status) {
+	radio_power = status == SI4734_OVERFLOW ? RADIO_ON : RADIO_OFF; //not sent: again next run
+}
+
+static void radio_tune_done(uint8_t status) {
+	radio_result(status); //retried by radio_control()
+	radio_tuning = false;
+}
+
+//true if nothing failed, or the wait before the next try is over
+static bool radio_retry_due(uint16_t now) {
+	uint8_t sreg = SREG;
+	uint8_t failures;
+	uint16_t failed_at;
+
+	cli(); //both are set by the si4734 callbacks, and failed_at takes two loads
+	failures = radio_failures;
+	failed_at = radio_failed_at;
+	SREG = sreg;
+	return !failures ||
+	       (failures < RADIO_TRIES && (uint16_t)(now - failed_at) >= RADIO_RETRY_TICKS << (failures - 1));
+}
+
+//a retry would not come: shown until the next frequency or power up
+bool radio_failed_out(void) {
+	return radio_failures >= RADIO_TRIES;
+}
+
+static void radio_seek_end(uint16_t freq) {
+	radio_found = freq;
+	radio_seek_done = true;
+}
+
+//where the chip is after a seek, or after the tune to the bottom of the band
+//that starts a scan, from the tune status the command ends with. The scan
+//notes the station and seeks on up, until the seek hits the top of the band.
+static void radio_seek_status(uint8_t status) {
+	const uint8_t *r = si4734_tune_status_buf;
+	uint16_t freq = (uint16_t)r[2] << 8 | r[3];
+
+	if (status) {radio_seek_end(0); return;}
+	if (radio_seeking != SEEK_SCAN) {radio_seek_end(freq); return;}
+	if (r[1] & FM_TUNE_STATUS_VALID) {station_add(freq, r[4], r[5]);}
+	if ((r[1] & FM_TUNE_STATUS_BLTF) || freq >= FM_BAND_TOP) {radio_seek_end(freq);}
+	else {fm_seek_start(1, 0, radio_seek_status);} //up, without wrap
+}
+
+static void radio_seek_start(RadioSeek seek) {
+	radio_seeking = seek;
+	if (seek == SEEK_SCAN) {
+		station_clear();
+		current_fm_freq = FM_BAND_BOTTOM;
+		fm_tune_freq(radio_seek_status);
+	}
+	else {fm_seek_start(seek == SEEK_UP, 1, radio_seek_status);}
+}
+
+//sets the frequency for something other than the knob: tuned on the next
+//run, and recorded for the replay, which has no station index
+static void radio_goto(uint16_t freq) {
+	encoder_freq = freq;
+	radio_jump = true;
+	trace_station(freq);
+}
+
+//the end of a seek or scan: the chip is on radio_found already. A scan
+//saves the index and goes to its first station.
+static void radio_seek_finish(void) {
+	RadioSeek seek = radio_seeking;
+
+	radio_seek_done = false;
+	radio_seeking = SEEK_NONE;
+	radio_tuned_freq = radio_found; //0 after a failure: retune encoder_freq
+	if (seek == SEEK_SCAN) {
+		station_save();
+		radio_goto(stations.count ? station_freq(0) : encoder_freq);
+	}
+	else if (radio_found) { //already there, nothing to tune
+		current_fm_freq = encoder_freq = radio_found;
+		trace_station(radio_found);
+	}
+}
+
+static void radio_power_up(void) {
+	radio_power = RADIO_STARTING;
+	radio_powered_band = current_radio_band;
+	radio_tuned_freq = 0;
+	switch (current_radio_band) {
+		case FM: fm_pwr_up(radio_up_done); break;
+		case AM: am_pwr_up(radio_up_done); break;
+		case SW: sw_pwr_up(radio_up_done); break;
+	}
+}
+
+//from AM to SW or back, without a power cycle
+static void radio_band_switch(void) {
+	radio_power = RADIO_STARTING;
+	radio_powered_band = current_radio_band;
+	radio_tuned_freq = 0;
+	set_band_profile(current_radio_band, radio_up_done);
+}
+
+static void radio_tune(uint16_t freq) {
+	if (freq != radio_tuned_freq) {radio_failures = 0;} //a new frequency gets its own tries
+	radio_tuned_freq = freq;
+	radio_tuning = true;
+	radio_jump = false;
+	trace_freq(freq);
+	switch (current_radio_band) {
+		case FM: current_fm_freq = freq; fm_tune_freq(radio_tune_done); break;
+		case AM: current_am_freq = freq; am_tune_freq(radio_tune_done); break;
+		case SW: current_sw_freq = freq; sw_tune_freq(radio_tune_done); break;
+	}
+}
+
+void radio_control(void) {
+	static uint16_t seen_freq = 0;  //encoder_freq on the last run
+	static uint16_t seen_at = 0;    //tick it last changed
+	uint16_t now = sched_now();
+	uint16_t want = encoder_freq;
+	bool on = (clock_mode == RADIO_MODE);
+
+	if (radio_seek_done) {radio_seek_finish(); want = encoder_freq;}
+	if (want != seen_freq) {seen_freq = want; seen_at = now;}
+
+	switch (radio_power) {
+		case RADIO_OFF:
+			if (!on) {radio_failures = 0;} //entering the mode tries afresh
+			else if (radio_retry_due(now)) {radio_power_up();}
+			break;
+		case RADIO_ON:
+			if (radio_tuning || radio_seeking != SEEK_NONE) {break;} //let it finish first
+			if (on && radio_powered_band != FM && current_radio_band != FM &&
+			    radio_powered_band != current_radio_band) {
+				radio_seek_req = SEEK_NONE;
+				radio_band_switch();
+			}
+			else if (!on || radio_powered_band != current_radio_band) {
+				radio_power = RADIO_STOPPING;
+				radio_seek_req = SEEK_NONE;
+				radio_pwr_dwn(radio_down_done);
+			}
+			else if (radio_seek_req != SEEK_NONE && radio_tuned_freq) {
+				if (radio_seek_req == SEEK_SCAN && station_busy()) {break;} //last index still saving
+				if (current_radio_band == FM) {radio_seek_start(radio_seek_req);}
+				radio_seek_req = SEEK_NONE;
+			}
+			else if (want != radio_tuned_freq &&
+			         (!radio_tuned_freq || radio_jump || (uint16_t)(now - seen_at) >= RADIO_SETTLE_TICKS)) {
+				radio_tune(want); //the first tune after power up does not wait
+			}
+			else if (radio_failures && radio_retry_due(now)) {radio_tune(radio_tuned_freq);}
+			break;
+		default: break; //a power up or down is under way
+	}
+}
+
+//******************************************************************************
+//                          seek and preset requests
+//From the UI, in RADIO_MODE. radio_preset() steps through the station index
+//in frequency order; before the first scan it seeks instead. Both are FM
+//only.
+//******************************************************************************
+void radio_seek(RadioSeek seek) {
+	radio_seek_req = seek;
+}
+
+void radio_preset(int8_t dir) {
+	uint16_t freq;
+
+	if (current_radio_band != FM) {return;}
+	freq = station_next(encoder_freq, dir);
+	if (freq) {radio_goto(freq);}
+	else {radio_seek(dir > 0 ? SEEK_UP : SEEK_DOWN);}
+}
+
+//******************************************************************************
+//                              radio_band_next
+//From the UI: FM, AM, SW and around again. encoder_freq is the frequency of
+//the current band; the band left keeps it, the band entered brings its own
+//back, or its default if it has none in range yet. radio_control() does the
+//rest. The replay follows from the inputs and the frequencies at reset.
+//******************************************************************************
+void radio_band_next(void) {
+	band_freq_set(current_radio_band, encoder_freq);
+	current_radio_band = current_radio_band == SW ? FM : current_radio_band + 1;
+	encoder_freq = band_freq(current_radio_band);
+}
+
+#endif
@@ -0,0 +1,78 @@
+// scheduler.c
+// Deferred, prioritized task scheduler driven from main()'s while(1).
+// See scheduler.h for how tasks are declared.
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "scheduler.h"
+
+volatile uint16_t sched_ticks;
+
+//****************************************************************************
+//                              task_post
+//Marks a task ready. Posting it again before it ran keeps the first
+//timestamp, so the lateness of the oldest request is what gets measured.
+//****************************************************************************
+void task_post(uint8_t task){
+  uint8_t sreg = SREG;
+  cli();
+  if (!tasks[task].posted) {
+    tasks[task].posted = 1;
+    tasks[task].posted_at = sched_ticks;
+  }
+  SREG = sreg;
+}
+
+//****************************************************************************
+//                              sched_tick
+//Called once per TIMER2 overflow: advances the time base and posts the
+//periodic tasks that are due. Runs with interrupts off.
+//****************************************************************************
+void sched_tick(void){
+  sched_ticks++;
+  for (uint8_t i = 0; i < num_tasks; i++) {
+    if (!tasks[i].period) continue;
+    if (tasks[i].countdown > 1) {tasks[i].countdown--; continue;}
+    tasks[i].countdown = tasks[i].period;
+    if (!tasks[i].posted) {
+      tasks[i].posted = 1;
+      tasks[i].posted_at = sched_ticks;
+    }
+  }
+}
+
+//the 16 bit tick count needs two loads, which a tick must not split
+uint16_t sched_now(void){
+  uint16_t now;
+  uint8_t sreg = SREG;
+  cli();
+  now = sched_ticks;
+  SREG = sreg;
+  return now;
+}
+
+//****************************************************************************
+//                              sched_run
+//Runs the highest priority task that is posted, to completion, and keeps
+//its latency statistics. Returns 0 if there was nothing to do.
+//****************************************************************************
+uint8_t sched_run(void){
+  uint16_t latency;
+
+  for (uint8_t i = 0; i < num_tasks; i++) {
+    task_t *t = &tasks[i];
+    if (!t->posted) continue;
+
+    cli();
+    latency = sched_ticks - t->posted_at;
+    t->posted = 0;
+    sei();
+
+    if (latency > t->deadline) t->overruns++;
+    if (latency > t->max_latency) t->max_latency = latency;
+    t->runs++;
+    t->run();
+    return 1;
+  }
+  return 0;
+}
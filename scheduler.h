@@ -0,0 +1,36 @@
+//scheduler.h
+//Run to completion task scheduler. ISRs only timestamp and post; the work
+//runs from main()'s while(1) through sched_run(), highest priority first.
+//
+//The application defines tasks[] in priority order (index 0 runs first) and
+//num_tasks. A task with a period is posted by sched_tick() every "period"
+//ticks of TIMER2; the others are posted with task_post(). A task that starts
+//more than "deadline" ticks after it was posted counts an overrun.
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+
+typedef struct {
+  void      (*run)(void);
+  uint8_t   period;       //ticks between automatic posts, 0 for none
+  uint8_t   deadline;     //ticks allowed from post to start
+  volatile uint8_t  posted;
+  volatile uint16_t posted_at;  //tick of the first post not yet run
+  uint8_t   countdown;    //ticks to the next automatic post
+  uint16_t  runs;
+  uint16_t  overruns;     //started after the deadline
+  uint16_t  max_latency;  //worst ticks from post to start
+} task_t;
+
+extern task_t           tasks[];
+extern const uint8_t    num_tasks;
+extern volatile uint16_t sched_ticks;   //TIMER2 ticks since reset
+
+void    sched_tick(void);         //from the TIMER2 ISR
+uint16_t sched_now(void);         //sched_ticks, read atomically
+void    task_post(uint8_t task);  //from an ISR or main()
+uint8_t sched_run(void);          //runs one task, 0 when none was pending
+
+#endif
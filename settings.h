@@ -0,0 +1,149 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <stddef.h>
+#include <string.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include "globals.h"
+#include "scheduler.h"
+#include "eeprom_queue.h"
+#include "alarms.h"
+
+//******************************************************************************
+//                            settings journal
+//The user's settings are kept in EEPROM as a journal of SETTINGS_SLOTS
+//records, each with a version, a sequence number and a CRC-8. A save appends
+//the next record in the slot after the last one rather than rewriting fixed
+//addresses, so every cell of the journal wears at 1/SETTINGS_SLOTS of the
+//save rate. settings_load() picks the valid record with the highest sequence
+//number at reset; a record cut short by a reset fails its CRC and the one
+//before it is used instead.
+//
+//settings_poll() runs from settings_task. It saves only settings that differ
+//from the last record, and only after they have been left alone for
+//SETTINGS_IDLE_TICKS, so turning a knob through fifty values costs one
+//record. The record is handed to the EE_READY write queue (eeprom_queue.h),
+//which skips the bytes the slot already holds, so the task never waits on
+//the EEPROM.
+//
+//The journal sits at a fixed address rather than in an EEMEM variable, as
+//the write queue takes EEPROM addresses.
+//******************************************************************************
+#define SETTINGS_VERSION    2     //2: the alarm table
+#define SETTINGS_BASE       0x000 //EEPROM address of slot 0
+#define SETTINGS_SLOTS      32    //of 32 bytes, 1 KB of EEPROM
+#define SETTINGS_ADDR(slot) (SETTINGS_BASE + (slot) * sizeof(settings_t))
+#define SETTINGS_IDLE_TICKS 3000  //about 3 s without a change before a save
+
+typedef struct {
+	uint8_t  version;       //SETTINGS_VERSION, erased EEPROM reads 0xFF
+	uint8_t  seq;           //one more than the record before, wraps
+	uint16_t fm_freq;       //last frequency of each band, encoder_freq for the
+	uint16_t am_freq;       //current one
+	uint16_t sw_freq;
+	uint8_t  volume;        //OCR3A
+	uint8_t  band;
+	alarm_t  alarms[ALARM_COUNT];
+	uint8_t  alarm_armed;
+	uint8_t  crc;           //CRC-8 of the bytes before it
+} settings_t;
+
+settings_t settings_saved;                     //the latest complete record
+uint8_t    settings_slot = SETTINGS_SLOTS - 1; //slot of the latest or coming record
+uint16_t   settings_saves = 0;                 //records written since reset
+
+static uint8_t settings_crc(const settings_t *s) {
+	const uint8_t *b = (const uint8_t *)s;
+	uint8_t crc = 0;
+
+	for (uint8_t i = 0; i < offsetof(settings_t, crc); i++) {crc = _crc8_ccitt_update(crc, b[i]);}
+	return crc;
+}
+
+//compares the settings only, not the version, sequence or CRC
+static bool settings_same(const settings_t *a, const settings_t *b) {
+	return !memcmp(&a->fm_freq, &b->fm_freq, offsetof(settings_t, crc) - offsetof(settings_t, fm_freq));
+}
+
+static void settings_capture(settings_t *s) {
+	s->fm_freq = current_radio_band == FM ? encoder_freq : current_fm_freq;
+	s->am_freq = current_radio_band == AM ? encoder_freq : current_am_freq;
+	s->sw_freq = current_radio_band == SW ? encoder_freq : current_sw_freq;
+	s->volume = (uint8_t)OCR3A;
+	s->band = current_radio_band;
+	memcpy(s->alarms, alarms, sizeof(alarms));
+	s->alarm_armed = alarm_armed;
+}
+
+static void settings_apply(const settings_t *s) {
+	current_fm_freq = s->fm_freq;
+	current_am_freq = s->am_freq;
+	current_sw_freq = s->sw_freq;
+	OCR3A = s->volume;
+	current_radio_band = s->band <= SW ? s->band : FM;
+	encoder_freq = band_freq(current_radio_band);
+	memcpy(alarms, s->alarms, sizeof(alarms));
+	alarm_load();
+	alarm_armed = s->alarm_armed;
+}
+
+//******************************************************************************
+//                              settings_load
+//At reset, after the timers are set up and before sei(): restores the latest
+//valid record, or keeps the defaults when there is none.
+//******************************************************************************
+void settings_load(void) {
+	settings_t s;
+	bool found = false;
+
+	for (uint8_t i = 0; i < SETTINGS_SLOTS; i++) {
+		eeprom_read_block(&s, (const void *)SETTINGS_ADDR(i), sizeof(s));
+		if (s.version != SETTINGS_VERSION || s.crc != settings_crc(&s)) {continue;}
+		if (found && (int8_t)(s.seq - settings_saved.seq) <= 0) {continue;} //older
+		settings_saved = s;
+		settings_slot = i;
+		found = true;
+	}
+	if (found) {settings_apply(&settings_saved);}
+	else {
+		settings_capture(&settings_saved); //nothing to save until a change
+		settings_saved.seq = 0xFF;         //the first record is number 0
+	}
+}
+
+//******************************************************************************
+//                              settings_poll
+//From settings_task: notes a record the queue has finished, or queues one
+//once changed settings have been still for SETTINGS_IDLE_TICKS.
+//******************************************************************************
+void settings_poll(void) {
+	static settings_t seen;      //settings on the last run
+	static uint16_t seen_at = 0; //tick they last changed
+	static settings_t record;    //the record being written, read by the ISR
+	static bool writing = false;
+	uint16_t now = sched_now();
+	settings_t s;
+
+	if (writing) {
+		if (ee_busy()) {return;}
+		settings_saved = record;
+		settings_saves++;
+		writing = false;
+	}
+
+	settings_capture(&s);
+	if (!settings_same(&s, &seen)) {seen = s; seen_at = now; return;}
+	if (settings_same(&s, &settings_saved)) {return;}
+	if ((uint16_t)(now - seen_at) < SETTINGS_IDLE_TICKS) {return;}
+
+	s.version = SETTINGS_VERSION;
+	s.seq = settings_saved.seq + 1;
+	s.crc = settings_crc(&s);
+	record = s;
+	if (!ee_queue(SETTINGS_ADDR((settings_slot + 1) % SETTINGS_SLOTS), &record, sizeof(record))) {return;}
+	settings_slot = (settings_slot + 1) % SETTINGS_SLOTS;
+	writing = true;
+}
+
+#endif
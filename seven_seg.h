@@ -1,12 +1,14 @@
 #ifndef SEVEN_SEG_H
 #define SEVEN_SEG_H
 
+#include <avr/pgmspace.h>
 #include "globals.h"
 //holds data to be sent to the segments. logic zero turns segment on
 volatile uint8_t segment_data[5] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 
-//decimal to 7-segment LED display encodings, logic "0" turns on segment
-uint8_t dec_to_7seg[13] = {
+//decimal to 7-segment LED display encodings, logic "0" turns on segment.
+//The tables below live in flash; read them with pgm_read_byte() or seg_code().
+const uint8_t dec_to_7seg[13] PROGMEM = {
 	0b11000000, //number 0
 	0b11111001, //number 1
 	0b10100100, //number 2
@@ -22,23 +24,66 @@ uint8_t dec_to_7seg[13] = {
   0b01111111
 };
 
+#define seg_code(i) pgm_read_byte(&dec_to_7seg[i])
+
+//packed BCD of 0-59, for hours and minutes
+const uint8_t bin_to_bcd[60] PROGMEM = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09,
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19,
+	0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29,
+	0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+	0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+	0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59
+};
+
+//******************************************************************************/
+//                                 time_to_bcd
+//Packs an hour and minute as |h tens|h ones|m tens|m ones| by table lookup.
+//A field out of range (an alarm wound past 59) shows as blank digits.
+//******************************************************************************/
+uint16_t time_to_bcd(uint8_t hour, uint8_t minute) {
+	uint8_t h = (hour   < 60) ? pgm_read_byte(&bin_to_bcd[hour])   : 0xAA;
+	uint8_t m = (minute < 60) ? pgm_read_byte(&bin_to_bcd[minute]) : 0xAA;
+	return ((uint16_t)h << 8) | m;
+}
+
+//******************************************************************************/
+//                                 freq_to_bcd
+//Takes a radio frequency in 10 kHz units and returns it in 100 kHz units as
+//four packed BCD digits (10790 -> 0x1079). Each digit is counted out by
+//subtraction, at most 9 steps, so there is no software division.
+//******************************************************************************/
+uint16_t freq_to_bcd(uint16_t freq) {
+	static const uint16_t place[4] PROGMEM = {10000, 1000, 100, 10};
+	uint16_t bcd = 0;
+
+	for (uint8_t i = 0; i < 4; i++) {
+		uint16_t step = pgm_read_word(&place[i]);
+		uint8_t digit = 0;
+		while (freq >= step) {freq -= step; digit++;}
+		bcd = (bcd << 4) | digit;
+	}
+	return bcd;
+}
+
 //******************************************************************************/
 //                                   segment_sum                                    
-//takes a 16-bit binary input value and places the appropriate equivalent 4 digit 
-//BCD segment code in the array segment_data for display.                       
+//takes a 4 digit packed BCD value and places the segment code of each digit,
+//looked up directly from its nibble, in the array segment_data for display.
 //array is loaded at exit as:  |digit3|digit2|colon|digit1|digit0|
 //******************************************************************************/
-void segsum(uint16_t sum) {
-	//break up decimal sum into 4 digit-segments
-	uint8_t digit3 = dec_to_7seg[(sum/1000)];     //thousands place
-	uint8_t digit2 = dec_to_7seg[(sum/100) % 10]; //hundreds place
-	uint8_t digit1 = dec_to_7seg[(sum/10)  % 10]; //tens place
-	uint8_t digit0 = dec_to_7seg[(sum/1)   % 10]; //ones place 
+void segsum(uint16_t bcd) {
+	uint8_t digit3 = seg_code(bcd >> 12);          //thousands place
+	uint8_t digit2 = seg_code((bcd >> 8) & 0x0F);  //hundreds place
+	uint8_t digit1 = seg_code((bcd >> 4) & 0x0F);  //tens place
+	uint8_t digit0 = seg_code(bcd & 0x0F);         //ones place 
 
 	if (clock_mode == RADIO_MODE) {
-		digit1 &= ~(1UL << 7);
-		if ( digit3 == dec_to_7seg[0]) {
-			digit3 = dec_to_7seg[10];
+		//the point before the MHz fraction: 99.9 on FM, 9.50 on SW, none on AM
+		if (current_radio_band == FM) {digit1 &= ~(1UL << 7);}
+		else if (current_radio_band == SW) {digit2 &= ~(1UL << 7);}
+		if ( digit3 == seg_code(0)) {
+			digit3 = seg_code(10);
 		}
 	}
 	//now move data to right place for misplaced colon position
@@ -3,22 +3,42 @@
 //device driver for the si4734 chip.
 //TODO: unify the properties if possible between modes
 //TODO: unify power up commands...all 0x01?, think so, power ups look the same
-//TODO: document how this is now running with interrupt mode
-//      and not blind timing. 
+//
+//Commands are queued and run one at a time by a state machine that only
+//advances from interrupts, so no caller ever waits on the chip:
+//
+//  SI_SEND  the command bytes are queued on the TWI bus
+//  SI_CTS   written; wait out the chip's processing time (clear to send),
+//           counted down in TIMER2 ticks by si4734_tick()
+//  SI_READ  the response is being read, for commands that have one
+//  SI_STC   a tune or seek: wait for the seek/tune complete pulse on INT7
+//           (si4734_stc()), or give up after SI4734_STC_TICKS (a tune) or
+//           SI4734_SEEK_TICKS (a seek)
+//
+//then the command's callback gets the status and the next command starts.
+//A tune or seek is not through at STC: the chip keeps STCINT set, and gives
+//no pulse for the next tune, until a TUNE_STATUS with INTACK. So the command
+//turns into one in place, on STC and on the timeout alike, sent and read
+//like any other, and leaves the tune status in si4734_tune_status_buf.
+//The CTS times are the worst cases of the data sheet rather than the CTS
+//interrupt, as GPO2/INT is already the STC line.
+//
+//The driver remembers the properties it set since the last power up, so a
+//set_property() that would not change anything is not sent. Each band has
+//a profile of property values, sent as one run of queued commands by the
+//power ups and by set_band_profile().
 
 // header files
 #include <avr/interrupt.h>
 #include <avr/io.h>
 #include <stdlib.h>
 #include <util/twi.h>
-#include <avr/eeprom.h>
-#include <util/delay.h>
+#include <avr/pgmspace.h>
 //#include "../uart_functions.h"
 
 #include "twi_master.h" //my defines for TWCR_START, STOP, RACK, RNACK, SEND
 #include "si4734.h"
 
-uint8_t si4734_wr_buf[9];          //buffer for holding data to send to the si4734 
 uint8_t si4734_rd_buf[15];         //buffer for holding data recieved from the si4734
 uint8_t si4734_tune_status_buf[8]; //buffer for holding tune_status data  
 uint8_t si4734_revision_buf[16];   //buffer for holding revision  data  
@@ -28,10 +48,6 @@ enum radio_band{FM, AM, SW};
 
 volatile uint8_t STC_interrupt;  //flag bit to indicate tune or seek is done
 
-extern uint16_t eeprom_fm_freq;
-extern uint16_t eeprom_am_freq;
-extern uint16_t eeprom_sw_freq;
-extern uint8_t  eeprom_volume;
 extern volatile uint16_t current_fm_freq;
 extern uint16_t current_am_freq;
 extern uint16_t current_sw_freq;
@@ -42,118 +58,376 @@ extern uint8_t  current_volume;
 //extern char uart1_rx_buf[40];      //holds string that recieves data from uart
 //******************************************************************
 
+//one queued command, with the bytes it sends, so callers need no buffer
+typedef struct {
+  uint8_t       cmd[6];
+  uint8_t       len;
+  uint8_t       cts;       //ticks from the write to CTS
+  uint8_t      *resp;      //response buffer, NULL for none
+  uint8_t       resp_len;
+  uint16_t      stc;       //a tune or seek: ticks to wait for STC, 0 for none
+  si4734_done_t done;
+} si_cmd_t;
+
+enum {SI_IDLE, SI_SEND, SI_CTS, SI_READ, SI_STC};
+
+static si_cmd_t         si_cmds[SI4734_QUEUE_SIZE];
+static volatile uint8_t si_head, si_tail; //si_tail is the running command
+static volatile uint8_t si_state = SI_IDLE;
+static volatile uint16_t si_wait;         //ticks left in SI_SEND, SI_CTS or SI_STC
+static uint8_t          si_stc_status;    //of the tune or seek the INTACK ends
+
+volatile uint8_t si4734_overflows; //commands refused on a full queue
+
+static void si_start(void);
+static void si_props_forget(void);
 
 //********************************************************************************
-//                            get_int_status()
+//Ends the running command, starts the next one and then reports "status"
+//to the callback. Runs in interrupt context, like everything below that
+//advances the state machine. A failed command may have been a property, or
+//have kept one from the chip, so the property cache is dropped.
+//
+static void si_finish(uint8_t status){
+  si4734_done_t done = si_cmds[si_tail].done;
+
+  if (status) {si_props_forget();}
+
+  si_tail = (si_tail + 1) & (SI4734_QUEUE_SIZE - 1);
+  si_state = SI_IDLE;
+  si_wait = 0;
+  si_stc_status = 0;
+  if (si_tail != si_head) {si_start();}
+  if (done) {done(status);}
+}
+
+//TWI callback of the response read; after a tune or seek, its own status
+//unless the read failed
+static void si_read_done(uint8_t status){si_finish(status ? status : si_stc_status);}
+
+//TWI callback of the command write: the chip starts processing now
+static void si_sent(uint8_t status){
+  if (status) {si_finish(status); return;}
+  si_state = SI_CTS;
+  si_wait = si_cmds[si_tail].cts;
+}
+
+//writes the command at si_tail, or retries on the next tick if the TWI
+//queue is full. A command without bytes only orders a callback after the
+//commands before it and finishes on the next tick.
+static void si_start(void){
+  si_cmd_t *c = &si_cmds[si_tail];
+
+  if (!c->len) {si_state = SI_CTS; si_wait = 1; return;}
+  si_state = SI_SEND;
+  if (c->stc) {STC_interrupt = FALSE;}
+  si_wait = twi_queue(SI4734_ADDRESS, c->cmd, c->len, si_sent) ? 0 : 1;
+}
+
+//STC of the running tune or seek, or its timeout: the command becomes the
+//TUNE_STATUS of its receiver with INTACK, which clears STCINT
+static void si_ack(uint8_t status){
+  si_cmd_t *c = &si_cmds[si_tail];
+
+  c->cmd[0] = c->cmd[0] == AM_TUNE_FREQ ? AM_TUNE_STATUS : FM_TUNE_STATUS;
+  c->cmd[1] = FM_TUNE_STATUS_IN_INTACK; //same bit for AM
+  c->len = 2;
+  c->cts = SI4734_TICKS(300);
+  c->resp = si4734_tune_status_buf;
+  c->resp_len = 8;
+  c->stc = 0;
+  si_stc_status = status;
+  si_start();
+}
+
+//CTS: read the response, wait for STC or finish
+static void si_cts(void){
+  si_cmd_t *c = &si_cmds[si_tail];
+
+  if (c->resp_len) {
+    si_state = SI_READ;
+    if (!twi_queue(SI4734_ADDRESS | TW_READ, c->resp, c->resp_len, si_read_done)) {
+      si_state = SI_CTS;      //TWI queue full, try again next tick
+      si_wait = 1;
+    }
+  }
+  else if (c->stc) {
+    if (STC_interrupt) {si_ack(0);}
+    else {si_state = SI_STC; si_wait = c->stc;}
+  }
+  else {si_finish(0);}
+}
+
+//********************************************************************************
+//                            si4734_tick()
 //
-//Fetch the interrupt status available from the status byte.
+//Called from the TIMER2 ISR every tick: runs the CTS and STC deadlines.
 //
-//TODO: update for interrupts
-// 
-uint8_t get_int_status(){
+void si4734_tick(void){
+  if (!si_wait || --si_wait) {return;}
+  switch (si_state) {
+    case SI_SEND: si_start(); break;
+    case SI_CTS:  si_cts(); break;
+    case SI_STC:  si_ack(SI4734_TIMEOUT); break;
+  }
+}
 
-    si4734_wr_buf[0] = GET_INT_STATUS;              
-    twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 1); //send get_int_status command
-    while( twi_busy() ){}; //spin while previous TWI transaction finshes
-    _delay_us(300);        //si4734 process delay
-    twi_start_rd(SI4734_ADDRESS, si4734_rd_buf, 1); //get the interrupt status 
-    while( twi_busy() ){}; //spin while previous TWI transaction finshes
-    return(si4734_rd_buf[0]);
+//********************************************************************************
+//                            si4734_stc()
+//
+//Called from the INT7 ISR, the seek/tune complete pulse.
+//
+void si4734_stc(void){
+  STC_interrupt = TRUE;
+  if (si_state == SI_STC) {si_ack(0);}
+}
+
+//true while a command is running or queued
+uint8_t si4734_busy(void){
+  return si_head != si_tail;
+}
+
+//free slots of the queue, one is always kept free
+static uint8_t si_room(void){
+  return (si_tail - si_head - 1) & (SI4734_QUEUE_SIZE - 1);
+}
+
+//********************************************************************************
+//Queues a command and starts it if the chip is idle. Returns 0 if the queue
+//is full, after calling the command's callback with SI4734_OVERFLOW, so its
+//caller still hears the command is through. Callable from main() and from
+//callbacks.
+//
+static uint8_t si_queue(si_cmd_t c){
+  uint8_t sreg = SREG;
+  uint8_t next;
+
+  cli();
+  next = (si_head + 1) & (SI4734_QUEUE_SIZE - 1);
+  if (next == si_tail) {
+    si4734_overflows++;
+    SREG = sreg;
+    if (c.done) {c.done(SI4734_OVERFLOW);}
+    return 0;
+  }
+  si_cmds[si_head] = c;
+  si_head = next;
+  if (si_state == SI_IDLE) {si_start();}
+  SREG = sreg;
+  return 1;
+}
+
+//********************************************************************************
+//                            get_int_status()
+//
+//Fetch the interrupt status available from the status byte, into
+//si4734_rd_buf[0].
+//
+uint8_t get_int_status(si4734_done_t done){
+  return si_queue((si_cmd_t){{GET_INT_STATUS}, 1, SI4734_TICKS(300), si4734_rd_buf, 1, 0, done});
 }
 //********************************************************************************
 
 //********************************************************************************
 //                            fm_tune_freq()
 //
-//takes current_fm_freq and sends it to the radio chip
+//takes current_fm_freq and sends it to the radio chip, done on STC and its
+//INTACK, with the tune status in si4734_tune_status_buf
 //
 
-void fm_tune_freq(){
-  si4734_wr_buf[0] = 0x20;  //fm tune command
-  si4734_wr_buf[1] = 0x00;  //no FREEZE and no FAST tune
-  si4734_wr_buf[2] = (uint8_t)(current_fm_freq >> 8); //freq high byte
-  si4734_wr_buf[3] = (uint8_t)(current_fm_freq);      //freq low byte
-  si4734_wr_buf[4] = 0x00;  //antenna tuning capactior
-  //send fm tune command
-  STC_interrupt = FALSE;
-  twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 5);
-  while( ! STC_interrupt ){}; //spin until the tune command finishes 
+uint8_t fm_tune_freq(si4734_done_t done){
+  return si_queue((si_cmd_t){{
+      FM_TUNE_FREQ,
+      0x00,                           //no FREEZE and no FAST tune
+      (uint8_t)(current_fm_freq >> 8), //freq high byte
+      (uint8_t)(current_fm_freq),      //freq low byte
+      0x00},                          //antenna tuning capactior
+    5, SI4734_TICKS(300), NULL, 0, SI4734_STC_TICKS, done});
+}
+//********************************************************************************
+
+//********************************************************************************
+//                            fm_seek_start()
+//
+//Seeks from the current frequency to the next channel that passes the RSSI and
+//SNR thresholds, up or down, wrapping at the band edges if "wrap" is set.
+//Without wrap a seek that finds nothing stops at the edge with BLTF set in
+//the tune status. Done on STC and its INTACK; si4734_tune_status_buf then
+//tells where it ended.
+//
+
+uint8_t fm_seek_start(uint8_t up, uint8_t wrap, si4734_done_t done){
+  return si_queue((si_cmd_t){{
+      FM_SEEK_START,
+      (up ? FM_SEEK_START_IN_SEEKUP : 0) | (wrap ? FM_SEEK_START_IN_WRAP : 0)},
+    2, SI4734_TICKS(300), NULL, 0, SI4734_SEEK_TICKS, done});
 }
 //********************************************************************************
 
 //********************************************************************************
 //                            am_tune_freq()
 //
-//takes current_am_freq and sends it to the radio chip
+//takes current_am_freq and sends it to the radio chip, done as fm_tune_freq()
 //
 
-void am_tune_freq(){
-  si4734_wr_buf[0] = AM_TUNE_FREQ; //am tune command
-  si4734_wr_buf[1] = 0x00;         //no FAST tune
-  si4734_wr_buf[2] = (uint8_t)(current_am_freq >> 8); //freq high byte
-  si4734_wr_buf[3] = (uint8_t)(current_am_freq);      //freq low byte
-  si4734_wr_buf[4] = 0x00;  //antenna tuning capactior high byte
-  si4734_wr_buf[5] = 0x00;  //antenna tuning capactior low byte
-  //send am tune command
-  STC_interrupt = FALSE;
-  twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 6);
-  while( ! STC_interrupt ){}; //spin until the tune command finishes 
+uint8_t am_tune_freq(si4734_done_t done){
+  return si_queue((si_cmd_t){{
+      AM_TUNE_FREQ,
+      0x00,                           //no FAST tune
+      (uint8_t)(current_am_freq >> 8), //freq high byte
+      (uint8_t)(current_am_freq),      //freq low byte
+      0x00,                           //antenna tuning capactior high byte
+      0x00},                          //antenna tuning capactior low byte
+    6, SI4734_TICKS(300), NULL, 0, SI4734_STC_TICKS, done});
 }
 //********************************************************************************
 
 //********************************************************************************
 //                            sw_tune_freq()
 //
-//takes current_sw_freq and sends it to the radio chip
+//takes current_sw_freq and sends it to the radio chip, done as fm_tune_freq()
 //antcap low byte is 0x01 as per datasheet
 
-void sw_tune_freq(){
-  si4734_wr_buf[0] = 0x40;  //am tune command
-  si4734_wr_buf[1] = 0x00;  //no FAST tune
-  si4734_wr_buf[2] = (uint8_t)(current_sw_freq >> 8); //freq high byte
-  si4734_wr_buf[3] = (uint8_t)(current_sw_freq);      //freq low byte
-  si4734_wr_buf[4] = 0x00;  //antenna tuning capactior high byte
-  si4734_wr_buf[5] = 0x01;  //antenna tuning capactior low byte 
-  //send am tune command
-  twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 6);
-   _delay_ms(80); //TODO: FIX
+uint8_t sw_tune_freq(si4734_done_t done){
+  return si_queue((si_cmd_t){{
+      AM_TUNE_FREQ,                   //am tune command
+      0x00,                           //no FAST tune
+      (uint8_t)(current_sw_freq >> 8), //freq high byte
+      (uint8_t)(current_sw_freq),      //freq low byte
+      0x00,                           //antenna tuning capactior high byte
+      0x01},                          //antenna tuning capactior low byte
+    6, SI4734_TICKS(300), NULL, 0, SI4734_STC_TICKS, done});
+}
+
+//********************************************************************************
+//                            property cache
+//
+//The values of the properties in the band profiles as the chip holds them: the
+//reset values after a power up, then whatever set_property() queued. A command
+//that fails drops them all (si_finish()), so the next profile sends every
+//property again. The profiles give each band's value of every property,
+//SI_PROP_ANY where the band does not use it. GPO_IEN comes last so a profile
+//ends by enabling STC.
+//
+#define SI_PROP_ANY     0xFFFF
+#define SI_PROP_UNKNOWN 0xFFFF //in the cache: equal to no profile value
+
+static const uint16_t si_prop_ids[SI4734_PROPS] PROGMEM = {
+  FM_SEEK_BAND_BOTTOM, FM_SEEK_BAND_TOP, FM_SEEK_TUNE_RSSI_THRESHOLD,
+  AM_SOFT_MUTE_MAX_ATTENUATION, AM_CHANNEL_FILTER, GPO_IEN};
+static const uint16_t si_prop_reset[SI4734_PROPS] PROGMEM = {
+  8750, 10790, 0x0014, 0x0010, AM_CHFILT_2KHZ, 0x0000};
+static const uint16_t si_profiles[3][SI4734_PROPS] PROGMEM = {
+  //FM: seeks cover the band of the encoder and stop only on channels clearly
+  //above the noise
+  {FM_BAND_BOTTOM, FM_BAND_TOP, SEEK_RSSI_MIN, SI_PROP_ANY, SI_PROP_ANY, GPO_IEN_STCIEN},
+  //AM: the reset values, which a switch from SW has to put back
+  {SI_PROP_ANY, SI_PROP_ANY, SI_PROP_ANY, 0x0010, AM_CHFILT_2KHZ, GPO_IEN_STCIEN},
+  //SW: no soft mute, 4 kHz filter with the power line filter
+  {SI_PROP_ANY, SI_PROP_ANY, SI_PROP_ANY, 0x0000, AM_CHFILT_4KHZ | AM_PWR_LINE_NOISE_REJT_FILTER, GPO_IEN_STCIEN},
+};
+
+static uint16_t si_prop_values[SI4734_PROPS];
+
+//at a power up
+static void si_props_reset(void){
+  for (uint8_t i = 0; i < SI4734_PROPS; i++) {si_prop_values[i] = pgm_read_word(&si_prop_reset[i]);}
+}
+
+//after a failed command
+static void si_props_forget(void){
+  for (uint8_t i = 0; i < SI4734_PROPS; i++) {si_prop_values[i] = SI_PROP_UNKNOWN;}
+}
+
+//index of "property" in the cache, SI4734_PROPS for one it does not hold
+static uint8_t si_prop_find(uint16_t property){
+  uint8_t i;
+
+  for (i = 0; i < SI4734_PROPS && pgm_read_word(&si_prop_ids[i]) != property; i++) {}
+  return i;
+}
+
+//calls "done" once the commands queued so far are through
+static uint8_t si_sync(si4734_done_t done){
+  return si_queue((si_cmd_t){{0}, 0, 0, NULL, 0, 0, done});
+}
+
+static si_cmd_t si_prop_cmd(uint16_t property, uint16_t property_value, si4734_done_t done){
+  return (si_cmd_t){{
+      SET_PROPERTY,                    //set property command
+      0x00,                            //all zeros
+      (uint8_t)(property >> 8),        //property high byte
+      (uint8_t)(property),             //property low byte
+      (uint8_t)(property_value >> 8),  //property value high byte
+      (uint8_t)(property_value)},      //property value low byte
+    6, SI4734_TICKS(10000), NULL, 0, 0, done};
+}
+
+//Queues "up", a power up or NULL, then the properties of "band" that differ
+//from the cache, with "done" after the last of them. All of it goes into the
+//queue or none of it does, so the chip is never left half set up: a queue
+//without room for the whole run only calls "done" with SI4734_OVERFLOW.
+static uint8_t si_profile(const si_cmd_t *up, uint8_t band, si4734_done_t done){
+  uint8_t sreg = SREG;
+  uint8_t sends = 0, last = SI4734_PROPS;
+
+  cli(); //a failing command may drop the cache meanwhile
+  for (uint8_t i = 0; i < SI4734_PROPS; i++) {
+    uint16_t value = pgm_read_word(&si_profiles[band][i]);
+    uint16_t held = up ? pgm_read_word(&si_prop_reset[i]) : si_prop_values[i];
+    if (value != SI_PROP_ANY && value != held) {sends++; last = i;}
+  }
+  if (si_room() < (up ? 1 : 0) + (sends ? sends : 1)) {
+    si4734_overflows++;
+    SREG = sreg;
+    if (done) {done(SI4734_OVERFLOW);}
+    return 0;
+  }
+  if (up) {si_queue(*up); si_props_reset();}
+  if (!sends) {si_sync(done);} //nothing to change
+  for (uint8_t i = 0; sends && i <= last; i++) {
+    uint16_t value = pgm_read_word(&si_profiles[band][i]);
+    if (value == SI_PROP_ANY || value == si_prop_values[i]) {continue;}
+    si_queue(si_prop_cmd(pgm_read_word(&si_prop_ids[i]), value, i == last ? done : NULL));
+    si_prop_values[i] = value;
+  }
+  SREG = sreg;
+  return 1;
+}
+
+//********************************************************************************
+//                            set_band_profile()
+//
+//Sends the properties of "band" (FM, AM or SW) that differ from what the chip
+//holds; "done" follows the last of them. Between AM and SW, which share the
+//AM receiver, this is all a band switch needs besides the tune.
+//
+uint8_t set_band_profile(uint8_t band, si4734_done_t done){
+  return si_profile(NULL, band, done);
 }
 
 //********************************************************************************
 //                            fm_pwr_up()
 //
-void fm_pwr_up(){
-//restore the previous fm frequency  
- current_fm_freq = eeprom_read_word(&eeprom_fm_freq); //TODO: only this one does not work 
- current_volume  = eeprom_read_byte(&eeprom_volume); //TODO: only this one does not work 
-
-//send fm power up command
-  si4734_wr_buf[0] = FM_PWR_UP; //powerup command byte
-  si4734_wr_buf[1] = 0x50;      //GPO2O enabled, STCINT enabled, use ext. 32khz osc.
-  si4734_wr_buf[2] = 0x05;      //OPMODE = 0x05; analog audio output
-  twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 3);
-  _delay_ms(120);               //startup delay as specified 
-  //The seek/tune interrupt is enabled here. If the STCINT bit is set, a 1.5us
-  //low pulse will be output from GPIO2/INT when tune or seek is completed.
-  set_property(GPO_IEN, GPO_IEN_STCIEN); //seek_tune complete interrupt
+uint8_t fm_pwr_up(si4734_done_t done){
+//send fm power up command: GPO2O enabled, STCINT enabled, use ext. 32khz osc.,
+//OPMODE = 0x05; analog audio output
+  si_cmd_t up = {{FM_PWR_UP, 0x50, 0x05}, 3, SI4734_TICKS(SI4734_PWR_UP_US), NULL, 0, 0, NULL};
+
+  //The profile ends with the seek/tune interrupt. If the STCINT bit is set, a
+  //1.5us low pulse will be output from GPIO2/INT when tune or seek is completed.
+  return si_profile(&up, FM, done);
 }
 //********************************************************************************
 
 //********************************************************************************
 //                            am_pwr_up()
 //
-void am_pwr_up(){
-//restore the previous am frequency  
-  current_am_freq = eeprom_read_word(&eeprom_am_freq);
-  current_volume  = eeprom_read_byte(&eeprom_volume); //TODO: only this one does not work 
-
-//send am power up command
-  si4734_wr_buf[0] = AM_PWR_UP;
-  si4734_wr_buf[1] = 0x51;//GPO2OEN and XOSCEN selected
-  si4734_wr_buf[2] = 0x05;
-  twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 3);
-  _delay_ms(120);   
-  set_property(GPO_IEN, GPO_IEN_STCIEN);    //Seek/Tune Complete interrupt
+uint8_t am_pwr_up(si4734_done_t done){
+//send am power up command, GPO2OEN and XOSCEN selected
+  si_cmd_t up = {{AM_PWR_UP, 0x51, 0x05}, 3, SI4734_TICKS(SI4734_PWR_UP_US), NULL, 0, 0, NULL};
+
+  return si_profile(&up, AM, done); //only the Seek/Tune Complete interrupt
 }
 //********************************************************************************
 
@@ -161,23 +435,13 @@ void am_pwr_up(){
 //                            sw_pwr_up()
 //
 
-void sw_pwr_up(){
-//restore the previous sw frequency  
-  current_sw_freq = eeprom_read_word(&eeprom_sw_freq);
-  current_volume  = eeprom_read_byte(&eeprom_volume); //TODO: only this one does not work 
-
+uint8_t sw_pwr_up(si4734_done_t done){
 //send sw power up command (same as am, only tuning rate is different)
-    si4734_wr_buf[0] = AM_PWR_UP; //same cmd as for AM
-    si4734_wr_buf[1] = 0x51;
-    si4734_wr_buf[2] = 0x05;
-    twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 3);
-    _delay_ms(120);   //start up delay
-
-  //set property to disable soft muting for shortwave broadcasts
-  set_property(AM_SOFT_MUTE_MAX_ATTENUATION, 0x0000); //cut off soft mute  
-  //select 4khz filter BW and engage power line filter
-  set_property(AM_CHANNEL_FILTER, (AM_CHFILT_4KHZ | AM_PWR_LINE_NOISE_REJT_FILTER)); 
-  set_property(GPO_IEN, GPO_IEN_STCIEN); //Seek/Tune Complete interrupt
+  si_cmd_t up = {{AM_PWR_UP, 0x51, 0x05}, 3, SI4734_TICKS(SI4734_PWR_UP_US), NULL, 0, 0, NULL};
+
+  //no soft mute for shortwave broadcasts, 4khz filter BW with the power line
+  //filter, then the Seek/Tune Complete interrupt
+  return si_profile(&up, SW, done);
 }
 //********************************************************************************
 
@@ -185,22 +449,11 @@ void sw_pwr_up(){
 //                            radio_pwr_dwn()
 //
 
-void radio_pwr_dwn(){
-
-//save current frequency to EEPROM
-switch(current_radio_band){
-  case(FM) : eeprom_write_word(&eeprom_fm_freq, current_fm_freq); break;
-  case(AM) : eeprom_write_word(&eeprom_am_freq, current_am_freq); break;
-  case(SW) : eeprom_write_word(&eeprom_sw_freq, current_sw_freq); break;
-  default  : break;
-}//switch      
-
-  eeprom_write_byte(&eeprom_volume, current_volume); //save current volume level
-
-//send fm power down command
-    si4734_wr_buf[0] = 0x11;
-    twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 1);
-   _delay_us(310); //power down delay
+//The frequencies are kept by the settings journal (settings.h), which
+//restores them at reset, so powering up or down no longer touches EEPROM.
+uint8_t radio_pwr_dwn(si4734_done_t done){
+//send power down command
+  return si_queue((si_cmd_t){{PWR_DOWN}, 1, SI4734_TICKS(310), NULL, 0, 0, done});
 }
 //********************************************************************************
 
@@ -210,21 +463,11 @@ switch(current_radio_band){
 //Get the status on the receive signal quality. This command returns signal strength 
 //(RSSI), signal to noise ratio (SNR), and other info. This function sets the
 //FM_RSQ_STATUS_IN_INTACK bit so it clears RSQINT and some other interrupt flags
-//inside the chip. 
-//TODO: Dang, thats a big delay, could cause problems, best check out.
-//
-void fm_rsq_status(){
-
-    si4734_wr_buf[0] = FM_RSQ_STATUS;            //fm_rsq_status command
-    si4734_wr_buf[1] = FM_RSQ_STATUS_IN_INTACK;  //clear STCINT bit if set
-    twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 2);
-    while(twi_busy()){}; //spin while previous TWI transaction finshes
-    _delay_us(300);      //delay for si4734 to process
-    //This is a blind wait. Waiting for CTS interrupt here would tell you 
-    //when the command is received and has been processed.
-    //get the fm tune status 
-    twi_start_rd(SI4734_ADDRESS, si4734_tune_status_buf, 8);
-    while(twi_busy()){}; //spin while previous TWI transaction finshes
+//inside the chip. The response lands in si4734_tune_status_buf.
+//
+uint8_t fm_rsq_status(si4734_done_t done){
+  return si_queue((si_cmd_t){{FM_RSQ_STATUS, FM_RSQ_STATUS_IN_INTACK}, 2, SI4734_TICKS(300),
+                      si4734_tune_status_buf, 8, 0, done});
 }
 
 
@@ -232,71 +475,51 @@ void fm_rsq_status(){
 //                            fm_tune_status()
 //
 //Get the status following a fm_tune_freq command. Returns the current frequency,
-//RSSI, SNR, multipath and antenna capacitance value. The STCINT interrupt bit
-//is cleared.
-//TODO: Dang, thats a big delay, could cause problems, best check out.
-//
-void fm_tune_status(){
-
-    si4734_wr_buf[0] = FM_TUNE_STATUS;            //fm_tune_status command
-    si4734_wr_buf[1] = FM_TUNE_STATUS_IN_INTACK;  //clear STCINT bit if set
-    twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 2);
-    while(twi_busy()){}; //spin while previous TWI transaction finshes
-    _delay_us(300);        //delay for si4734 to process
-    //get the fm tune status 
-    twi_start_rd(SI4734_ADDRESS, si4734_tune_status_buf, 8);
-    while( twi_busy() ){}; //spin till TWI read transaction finshes
+//RSSI, SNR, multipath and antenna capacitance value in si4734_tune_status_buf.
+//The STCINT interrupt bit is cleared.
+//
+uint8_t fm_tune_status(si4734_done_t done){
+  return si_queue((si_cmd_t){{FM_TUNE_STATUS, FM_TUNE_STATUS_IN_INTACK}, 2, SI4734_TICKS(300),
+                      si4734_tune_status_buf, 8, 0, done});
 }
 
 //********************************************************************************
 //                            am_tune_status()
 //
 //TODO: could probably just have one tune_status() function
-//TODO: Dang, thats a big delay, could cause problems, best check out.
-
-void am_tune_status(){
-
-    si4734_wr_buf[0] = AM_TUNE_STATUS;            //fm_tune_status command
-    si4734_wr_buf[1] = AM_TUNE_STATUS_IN_INTACK;  //clear STCINT bit if set
-    twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 2);
-    while(twi_busy()){}; //spin while previous TWI transaction finshes
-    _delay_us(300);        //delay for si4734 to process command
-    //get the am tune status 
-    twi_start_rd(SI4734_ADDRESS, si4734_tune_status_buf, 8);
 
+uint8_t am_tune_status(si4734_done_t done){
+  return si_queue((si_cmd_t){{AM_TUNE_STATUS, AM_TUNE_STATUS_IN_INTACK}, 2, SI4734_TICKS(300),
+                      si4734_tune_status_buf, 8, 0, done});
 }
 //********************************************************************************
 //                            am_rsq_status()
 //
-//TODO: Dang, thats a big delay, could cause problems, best check out.
 
-void am_rsq_status(){
-
-    si4734_wr_buf[0] = AM_RSQ_STATUS;            //am_rsq_status command
-    si4734_wr_buf[1] = AM_RSQ_STATUS_IN_INTACK;  //clear STCINT bit if set
-    twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 2);
-    while(twi_busy()){}; //spin while previous TWI transaction finshes
-    _delay_us(300);        //delay for si4734 to process command
-    //get the fm tune status 
-    twi_start_rd(SI4734_ADDRESS, si4734_tune_status_buf, 8);
+uint8_t am_rsq_status(si4734_done_t done){
+  return si_queue((si_cmd_t){{AM_RSQ_STATUS, AM_RSQ_STATUS_IN_INTACK}, 2, SI4734_TICKS(300),
+                      si4734_tune_status_buf, 8, 0, done});
 }
 
 //********************************************************************************
 //                            set_property()
 //
 //The set property command does not have a indication that it has completed. This
-//command is guarnteed by design to finish in 10ms. 
-//
-void set_property(uint16_t property, uint16_t property_value){
-
-    si4734_wr_buf[0] = SET_PROPERTY;                   //set property command
-    si4734_wr_buf[1] = 0x00;                           //all zeros
-    si4734_wr_buf[2] = (uint8_t)(property >> 8);       //property high byte
-    si4734_wr_buf[3] = (uint8_t)(property);            //property low byte
-    si4734_wr_buf[4] = (uint8_t)(property_value >> 8); //property value high byte
-    si4734_wr_buf[5] = (uint8_t)(property_value);      //property value low byte
-    twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 6);
-    _delay_ms(10);  //SET_PROPERTY command takes 10ms to complete
+//command is guarnteed by design to finish in 10ms. A property of the cache that
+//already holds "property_value" is not sent again. On a full queue the cache
+//keeps the old value, so the property is sent on the next try.
+//
+uint8_t set_property(uint16_t property, uint16_t property_value, si4734_done_t done){
+  uint8_t sreg = SREG;
+  uint8_t i = si_prop_find(property), queued;
+
+  cli(); //a failing command may drop the cache meanwhile
+  if (i < SI4734_PROPS && si_prop_values[i] == property_value) {queued = done ? si_sync(done) : 1;}
+  else if ((queued = si_queue(si_prop_cmd(property, property_value, done))) && i < SI4734_PROPS) {
+    si_prop_values[i] = property_value;
+  }
+  SREG = sreg;
+  return queued;
 }//set_property()
 
 //********************************************************************************
@@ -13,9 +13,22 @@
 #define AM_CHFILT_3KHZ                0x0002
 #define AM_CHFILT_2KHZ                0x0003
 #define AM_CHFILT_1KHZ                0x0004
+#define FM_SEEK_TUNE_RSSI_THRESHOLD   0x1404
+#define SEEK_RSSI_MIN                 30     //dBuV, the chip's default is 20
+#define FM_SEEK_BAND_BOTTOM           0x1400
+#define FM_SEEK_BAND_TOP              0x1401
+
+//the FM band in 10 kHz units: the encoder's (globals.h), the seeks' and the
+//station index's
+#define FM_BAND_BOTTOM                8750   //87.5 MHz, the chip's reset value
+#define FM_BAND_TOP                   10790  //107.9 MHz
+#define FM_SPACING                    20     //200 kHz channels
 
 //command definitions
 #define FM_TUNE_FREQ    0x20
+#define FM_SEEK_START   0x21
+#define FM_SEEK_START_IN_SEEKUP 0x08
+#define FM_SEEK_START_IN_WRAP   0x04
 #define FM_PWR_UP       0x01
 #define AM_PWR_UP       0x01
 #define AM_TUNE_FREQ    0x40
@@ -24,6 +37,8 @@
 #define GET_INT_STATUS  0x14
 #define FM_TUNE_STATUS_IN_INTACK 0x01
 #define FM_TUNE_STATUS  0x22
+#define FM_TUNE_STATUS_VALID 0x01  //resp1: the channel is a valid station
+#define FM_TUNE_STATUS_BLTF  0x80  //resp1: a seek hit the band limit
 #define FM_RSQ_STATUS_IN_INTACK 0x01
 #define FM_RSQ_STATUS   0x23
 #define AM_TUNE_STATUS_IN_INTACK 0x01
@@ -35,20 +50,45 @@
 #define FALSE           0x00
 #define TRUE            0x01
 
-//si4734.c function prototypes
-uint8_t get_int_status();
-void    fm_tune_freq();
-void    am_tune_freq();
-void    sw_tune_freq();
-void    fm_tune_status();
-void    fm_rsq_status();
-void    am_tune_status();
-void    am_rsq_status();
-void    fm_pwr_up();
-void    am_pwr_up();
-void    sw_pwr_up();
-void    radio_pwr_dwn();
-void    set_property();
+//command pipeline
+#define SI4734_QUEUE_SIZE  8       //commands, power of two, one slot kept free
+#define SI4734_TICK_US     1024    //TIMER2 tick, si4734_tick() period
+#define SI4734_TICKS(us)   ((us) / SI4734_TICK_US + 2) //at least "us" from any phase
+#define SI4734_PWR_UP_US   120000  //power up to CTS
+#define SI4734_STC_TICKS   250     //longest tune before giving up
+#define SI4734_SEEK_TICKS  6000    //longest seek, a sweep of the whole band
+#define SI4734_TIMEOUT     0x01    //status of a tune without STC; TWI errors are TWSR values
+#define SI4734_OVERFLOW    0x02    //status of a command the full queue refused
+#define SI4734_PROPS       6       //properties of the band profiles, cached
+
+//called from interrupt context when a command has completed: status is 0,
+//SI4734_TIMEOUT or the TWSR of a TWI error. SI4734_OVERFLOW comes at once,
+//from the caller of the command.
+typedef void (*si4734_done_t)(uint8_t status);
+
+extern volatile uint8_t si4734_overflows;
+extern uint8_t si4734_tune_status_buf[8]; //tune status after a tune or seek, or the last rsq status
+
+//si4734.c function prototypes; every command is queued and returns at once,
+//1 if queued, 0 if the queue was full; "done" may be NULL
+void    si4734_tick(void);   //from the TIMER2 ISR
+void    si4734_stc(void);    //from the INT7 ISR
+uint8_t si4734_busy(void);
+uint8_t get_int_status(si4734_done_t done);
+uint8_t fm_tune_freq(si4734_done_t done);
+uint8_t fm_seek_start(uint8_t up, uint8_t wrap, si4734_done_t done);
+uint8_t am_tune_freq(si4734_done_t done);
+uint8_t sw_tune_freq(si4734_done_t done);
+uint8_t fm_tune_status(si4734_done_t done);
+uint8_t fm_rsq_status(si4734_done_t done);
+uint8_t am_tune_status(si4734_done_t done);
+uint8_t am_rsq_status(si4734_done_t done);
+uint8_t fm_pwr_up(si4734_done_t done);
+uint8_t am_pwr_up(si4734_done_t done);
+uint8_t sw_pwr_up(si4734_done_t done);
+uint8_t radio_pwr_dwn(si4734_done_t done);
+uint8_t set_property(uint16_t property, uint16_t property_value, si4734_done_t done);
+uint8_t set_band_profile(uint8_t band, si4734_done_t done);
 void    get_rev();
 void    get_fm_rsq_status();
 
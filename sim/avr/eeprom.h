@@ -0,0 +1,30 @@
+//avr/eeprom.h (host simulation stand-in)
+//The simulated EEPROM is 4 KB. EEMEM variables are placed in their own host
+//section and addressed by offset into it; any other pointer is addressed by
+//its low 12 bits, the same truncation avr-libc applies on the target.
+//Writes block for the datasheet programming time and are counted per cell.
+
+#ifndef SIM_AVR_EEPROM_H
+#define SIM_AVR_EEPROM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define E2END      0x0FFF
+#define E2PAGESIZE 8
+#define EEMEM      __attribute__((section("sim_eeprom")))
+
+uint8_t  eeprom_read_byte(const uint8_t *p);
+uint16_t eeprom_read_word(const uint16_t *p);
+void     eeprom_read_block(void *dst, const void *src, size_t n);
+void     eeprom_write_byte(uint8_t *p, uint8_t value);
+void     eeprom_write_word(uint16_t *p, uint16_t value);
+void     eeprom_write_block(const void *src, void *dst, size_t n);
+void     eeprom_update_byte(uint8_t *p, uint8_t value);
+void     eeprom_update_word(uint16_t *p, uint16_t value);
+void     eeprom_update_block(const void *src, void *dst, size_t n);
+uint8_t  eeprom_is_ready(void);
+
+#define eeprom_busy_wait() do {} while (!eeprom_is_ready())
+
+#endif
@@ -0,0 +1,32 @@
+//avr/interrupt.h (host simulation stand-in)
+//ISR() defines an ordinary function named after the avr-libc vector symbol;
+//sim.c binds those names weakly into its vector table. sei()/cli() move the
+//simulated I bit so pending interrupts are taken at the next register access.
+
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+#include "sim.h"
+
+#define ISR(vector, ...) void vector(void); void vector(void)
+
+#define sei() sim_sei()
+#define cli() sim_cli()
+
+#define INT7_vect         __vector_8
+#define TIMER2_COMP_vect  __vector_9
+#define TIMER2_OVF_vect   __vector_10
+#define TIMER1_COMPA_vect __vector_12
+#define TIMER1_COMPB_vect __vector_13
+#define TIMER1_OVF_vect   __vector_14
+#define TIMER0_COMP_vect  __vector_15
+#define TIMER0_OVF_vect   __vector_16
+#define SPI_STC_vect      __vector_17
+#define USART0_RX_vect    __vector_18
+#define USART0_UDRE_vect  __vector_19
+#define ADC_vect          __vector_21
+#define EE_READY_vect     __vector_22
+#define TIMER3_OVF_vect   __vector_29
+#define TWI_vect          __vector_33
+
+#endif
@@ -0,0 +1,314 @@
+//avr/io.h (host simulation stand-in)
+//Register-level replacement for avr-libc's <avr/io.h>, ATmega128 only.
+//Every register expands to an access through sim_reg8()/sim_reg16() so the
+//simulator sees each touch of the hardware. Simulator sources define
+//SIM_RAW_IO before including this file to reach the plain storage instead.
+//Addresses are data space addresses (I/O address + 0x20).
+
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+#include <stdint.h>
+#include "sim.h"
+
+#ifdef SIM_RAW_IO
+#define _SFR_MEM8(addr)  (sim_io[(addr)])
+#define _SFR_MEM16(addr) (*(volatile uint16_t *)&sim_io[(addr)])
+#define _SFR_SPDR        (sim_spdr)
+#else
+#define _SFR_MEM8(addr)  (*sim_reg8(addr))
+#define _SFR_MEM16(addr) (*sim_reg16(addr))
+#define _SFR_SPDR        (*sim_spdr_reg()) //16 bits wide so writes can be seen
+#endif
+
+#define _BV(bit)                          (1 << (bit))
+#define bit_is_set(sfr, bit)              ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit)            (!((sfr) & _BV(bit)))
+#define loop_until_bit_is_set(sfr, bit)   do {} while (bit_is_clear(sfr, bit))
+#define loop_until_bit_is_clear(sfr, bit) do {} while (bit_is_set(sfr, bit))
+
+//port and pin registers
+#define PINF    _SFR_MEM8(0x20)
+#define PINE    _SFR_MEM8(0x21)
+#define DDRE    _SFR_MEM8(0x22)
+#define PORTE   _SFR_MEM8(0x23)
+#define PIND    _SFR_MEM8(0x30)
+#define DDRD    _SFR_MEM8(0x31)
+#define PORTD   _SFR_MEM8(0x32)
+#define PINC    _SFR_MEM8(0x33)
+#define DDRC    _SFR_MEM8(0x34)
+#define PORTC   _SFR_MEM8(0x35)
+#define PINB    _SFR_MEM8(0x36)
+#define DDRB    _SFR_MEM8(0x37)
+#define PORTB   _SFR_MEM8(0x38)
+#define PINA    _SFR_MEM8(0x39)
+#define DDRA    _SFR_MEM8(0x3A)
+#define PORTA   _SFR_MEM8(0x3B)
+#define DDRF    _SFR_MEM8(0x61)
+#define PORTF   _SFR_MEM8(0x62)
+#define PING    _SFR_MEM8(0x63)
+#define DDRG    _SFR_MEM8(0x64)
+#define PORTG   _SFR_MEM8(0x65)
+
+//ADC
+#define ADC     _SFR_MEM16(0x24)
+#define ADCW    _SFR_MEM16(0x24)
+#define ADCL    _SFR_MEM8(0x24)
+#define ADCH    _SFR_MEM8(0x25)
+#define ADCSRA  _SFR_MEM8(0x26)
+#define ADMUX   _SFR_MEM8(0x27)
+#define ACSR    _SFR_MEM8(0x28)
+
+//USART0
+#define UBRR0L  _SFR_MEM8(0x29)
+#define UCSR0B  _SFR_MEM8(0x2A)
+#define UCSR0A  _SFR_MEM8(0x2B)
+#define UDR0    _SFR_MEM8(0x2C)
+#define UBRR0H  _SFR_MEM8(0x90)
+#define UCSR0C  _SFR_MEM8(0x95)
+
+//SPI
+#define SPCR    _SFR_MEM8(0x2D)
+#define SPSR    _SFR_MEM8(0x2E)
+#define SPDR    _SFR_SPDR
+
+//EEPROM
+#define EECR    _SFR_MEM8(0x3C)
+#define EEDR    _SFR_MEM8(0x3D)
+#define EEAR    _SFR_MEM16(0x3E)
+#define EEARL   _SFR_MEM8(0x3E)
+#define EEARH   _SFR_MEM8(0x3F)
+
+//timers
+#define SFIOR   _SFR_MEM8(0x40)
+#define OCR2    _SFR_MEM8(0x43)
+#define TCNT2   _SFR_MEM8(0x44)
+#define TCCR2   _SFR_MEM8(0x45)
+#define ICR1    _SFR_MEM16(0x46)
+#define OCR1B   _SFR_MEM16(0x48)
+#define OCR1A   _SFR_MEM16(0x4A)
+#define TCNT1   _SFR_MEM16(0x4C)
+#define TCCR1B  _SFR_MEM8(0x4E)
+#define TCCR1A  _SFR_MEM8(0x4F)
+#define ASSR    _SFR_MEM8(0x50)
+#define OCR0    _SFR_MEM8(0x51)
+#define TCNT0   _SFR_MEM8(0x52)
+#define TCCR0   _SFR_MEM8(0x53)
+#define TIFR    _SFR_MEM8(0x56)
+#define TIMSK   _SFR_MEM8(0x57)
+#define OCR1C   _SFR_MEM16(0x78)
+#define TCCR1C  _SFR_MEM8(0x7A)
+#define ETIFR   _SFR_MEM8(0x7C)
+#define ETIMSK  _SFR_MEM8(0x7D)
+#define ICR3    _SFR_MEM16(0x80)
+#define OCR3C   _SFR_MEM16(0x82)
+#define OCR3B   _SFR_MEM16(0x84)
+#define OCR3A   _SFR_MEM16(0x86)
+#define TCNT3   _SFR_MEM16(0x88)
+#define TCCR3B  _SFR_MEM8(0x8A)
+#define TCCR3A  _SFR_MEM8(0x8B)
+#define TCCR3C  _SFR_MEM8(0x8C)
+
+//external interrupts, cpu
+#define MCUCSR  _SFR_MEM8(0x54)
+#define MCUCR   _SFR_MEM8(0x55)
+#define EIFR    _SFR_MEM8(0x58)
+#define EIMSK   _SFR_MEM8(0x59)
+#define EICRB   _SFR_MEM8(0x5A)
+#define EICRA   _SFR_MEM8(0x6A)
+#define SREG    _SFR_MEM8(0x5F)
+#define SREG_I  7
+
+//TWI
+#define TWBR    _SFR_MEM8(0x70)
+#define TWSR    _SFR_MEM8(0x71)
+#define TWAR    _SFR_MEM8(0x72)
+#define TWDR    _SFR_MEM8(0x73)
+#define TWCR    _SFR_MEM8(0x74)
+
+//port bits
+#define PA0 0
+#define PA1 1
+#define PA2 2
+#define PA3 3
+#define PA4 4
+#define PA5 5
+#define PA6 6
+#define PA7 7
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+#define PE0 0
+#define PE1 1
+#define PE2 2
+#define PE3 3
+#define PE4 4
+#define PE5 5
+#define PE6 6
+#define PE7 7
+#define PF0 0
+#define PF1 1
+#define PF2 2
+#define PF3 3
+#define PF4 4
+#define PF5 5
+#define PF6 6
+#define PF7 7
+
+//ADMUX, ADCSRA
+#define REFS1 7
+#define REFS0 6
+#define ADLAR 5
+#define MUX4  4
+#define MUX3  3
+#define MUX2  2
+#define MUX1  1
+#define MUX0  0
+#define ADEN  7
+#define ADSC  6
+#define ADFR  5
+#define ADIF  4
+#define ADIE  3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+
+//SPCR, SPSR
+#define SPIE  7
+#define SPE   6
+#define DORD  5
+#define MSTR  4
+#define CPOL  3
+#define CPHA  2
+#define SPR1  1
+#define SPR0  0
+#define SPIF  7
+#define WCOL  6
+#define SPI2X 0
+
+//EECR
+#define EERIE 3
+#define EEMWE 2
+#define EEWE  1
+#define EERE  0
+
+//TCCR0, TCCR2, ASSR
+#define FOC0  7
+#define WGM00 6
+#define COM01 5
+#define COM00 4
+#define WGM01 3
+#define CS02  2
+#define CS01  1
+#define CS00  0
+#define FOC2  7
+#define WGM20 6
+#define COM21 5
+#define COM20 4
+#define WGM21 3
+#define CS22  2
+#define CS21  1
+#define CS20  0
+#define AS0    3
+#define TCN0UB 2
+#define OCR0UB 1
+#define TCR0UB 0
+
+//TCCR1A/B, TCCR3A/B
+#define COM1A1 7
+#define COM1A0 6
+#define COM1B1 5
+#define COM1B0 4
+#define WGM11  1
+#define WGM10  0
+#define ICNC1  7
+#define ICES1  6
+#define WGM13  4
+#define WGM12  3
+#define CS12   2
+#define CS11   1
+#define CS10   0
+#define COM3A1 7
+#define COM3A0 6
+#define COM3B1 5
+#define COM3B0 4
+#define WGM31  1
+#define WGM30  0
+#define WGM33  4
+#define WGM32  3
+#define CS32   2
+#define CS31   1
+#define CS30   0
+
+//TIMSK, TIFR
+#define OCIE2  7
+#define TOIE2  6
+#define TICIE1 5
+#define OCIE1A 4
+#define OCIE1B 3
+#define TOIE1  2
+#define OCIE0  1
+#define TOIE0  0
+#define OCF2   7
+#define TOV2   6
+#define ICF1   5
+#define OCF1A  4
+#define OCF1B  3
+#define TOV1   2
+#define OCF0   1
+#define TOV0   0
+
+//EICRB, EIMSK, EIFR
+#define ISC71 7
+#define ISC70 6
+#define ISC61 5
+#define ISC60 4
+#define ISC51 3
+#define ISC50 2
+#define ISC41 1
+#define ISC40 0
+#define INT7  7
+#define INT6  6
+#define INT5  5
+#define INT4  4
+#define INTF7 7
+
+//TWCR
+#define TWINT 7
+#define TWEA  6
+#define TWSTA 5
+#define TWSTO 4
+#define TWWC  3
+#define TWEN  2
+#define TWIE  0
+
+//UCSR0A
+#define RXC0  7
+#define TXC0  6
+#define UDRE0 5
+
+//UCSR0B
+#define RXCIE0 7
+#define TXCIE0 6
+#define UDRIE0 5
+#define RXEN0  4
+#define TXEN0  3
+
+//UCSR0C
+#define UCSZ01 2
+#define UCSZ00 1
+
+#endif
@@ -0,0 +1,28 @@
+//avr/pgmspace.h (host simulation stand-in)
+//The host has one address space, so PROGMEM data is ordinary const data and
+//the pgm_read_* accessors and _P string functions are plain reads. Flash
+//reads do not count as register accesses.
+
+#ifndef SIM_AVR_PGMSPACE_H
+#define SIM_AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P              const char *
+#define PSTR(s)            (s)
+
+#define pgm_read_byte(p)   (*(const uint8_t *)(p))
+#define pgm_read_word(p)   (*(const uint16_t *)(p))
+
+#define memcpy_P           memcpy
+#define strlen_P           strlen
+#define strcmp_P           strcmp
+#define strcpy_P           strcpy
+#define strncpy_P          strncpy
+#define sprintf_P          sprintf
+#define snprintf_P         snprintf
+
+#endif
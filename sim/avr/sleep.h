@@ -0,0 +1,23 @@
+//avr/sleep.h (host simulation stand-in)
+//Sleeping moves the virtual clock straight to the next peripheral event,
+//whose interrupt wakes the cpu, and counts the skipped cycles as idle.
+
+#ifndef SIM_AVR_SLEEP_H
+#define SIM_AVR_SLEEP_H
+
+#include "sim.h"
+
+#define SLEEP_MODE_IDLE        0x00
+#define SLEEP_MODE_ADC         0x08
+#define SLEEP_MODE_PWR_DOWN    0x10
+#define SLEEP_MODE_PWR_SAVE    0x18
+#define SLEEP_MODE_STANDBY     0x14
+#define SLEEP_MODE_EXT_STANDBY 0x1C
+
+#define set_sleep_mode(mode) ((void)(mode)) //only idle is modelled
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu()  sim_sleep()
+#define sleep_mode() sim_sleep()
+
+#endif
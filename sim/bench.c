@@ -0,0 +1,839 @@
+//bench.c
+//Host unit checks and microbenchmarks for the logic that runs on every
+//TIMER2 tick (make bench). Links against the sim build of the firmware, so
+//the functions under test are the real ones from lab4.c and its headers,
+//with the register-level <avr/io.h> stand-in behind PINA and OCR3A.
+//
+//Every function is first checked exhaustively against a reference model,
+//then timed. Per call it reports host nanoseconds, host instructions (when
+//perf counters are available) and simulated register accesses, which are
+//the part of the cost that survives the move back to the ATmega128.
+//Exits non-zero if any check fails.
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "sim.h"
+#include "../time.h"
+
+//as in check_buttons.h, which defines the debouncer itself
+#define BUTTON_LONG_TICKS   500
+#define BUTTON_REPEAT_TICKS 100
+#define BUTTON_REPEAT_MASK  0x06
+#define ENC_INVALID         2    //and encoders.h
+
+//as in input_events.h
+#define EV_PRESS    0x00
+#define EV_RELEASE  0x10
+#define EV_LONG     0x20
+#define EV_REPEAT   0x30
+#define EV_ENCODER  0x40
+#define ENC_LEFT    0
+#define ENC_RIGHT   1
+typedef struct {uint8_t what; int8_t delta;} input_event_t;
+
+//as in alarms.h
+#define ALARM_COUNT     4
+#define ALARM_EVERY_DAY 0x7F
+#define ALARM_WEEKDAYS  0x3E
+typedef struct {uint8_t hour, minute, days, snooze, enabled;} alarm_t;
+
+//as in clock.h
+#define CLOCK_DAY 86400
+typedef struct {
+  uint16_t year;
+  uint8_t  month, day, weekday, hour, minute, second;
+  uint16_t week_minute;
+} calendar_t;
+
+//as in globals.h and radio.h
+enum radio_band {FM, AM, SW};
+typedef enum {SEEK_NONE, SEEK_DOWN, SEEK_UP, SEEK_SCAN} RadioSeek;
+
+//as in si4734.h
+typedef void (*si4734_done_t)(uint8_t status);
+#define SI4734_STC_TICKS  250
+#define SI4734_OVERFLOW   0x02
+#define SI4734_QUEUE_SIZE 8
+
+#define RUNS 1000000 //calls per timing loop
+
+//firmware under test
+void    segsum(uint16_t bcd);
+uint16_t time_to_bcd(uint8_t hour, uint8_t minute);
+uint16_t freq_to_bcd(uint16_t freq);
+void    chk_buttons(uint8_t raw);
+void    encoder_sample(uint8_t encoder);
+void    ui_event(input_event_t ev);
+uint8_t input_drain(void (*handler)(input_event_t ev));
+void    spi_init(void);
+void    tcnt1_init(void);
+void    volume_adjust(int8_t steps);
+void    time_adjust(volatile Time *modifier, int8_t steps);
+void    alarm_handler(bool alarm_armed);
+void    alarm_schedule(void);
+uint8_t clock_tick(void);
+int32_t clock_drift(int16_t temp);
+void    clock_trim(int32_t drift);
+void    clock_set(uint32_t seconds);
+const calendar_t *clock_calendar(void);
+uint16_t lm73_filter(uint16_t lm73_temp);
+void    station_clear(void);
+void    station_add(uint16_t freq, uint8_t rssi, uint8_t snr);
+uint16_t station_next(uint16_t freq, int8_t dir);
+int16_t lm73_tenths(uint16_t lm73_temp, uint8_t f_not_c);
+uint8_t lm73_temp_convert(char temp_digits[], uint16_t lm73_temp, uint8_t f_not_c);
+void    init_twi(void);
+void    si4734_tick(void);
+uint8_t si4734_busy(void);
+uint8_t twi_room(void);
+uint8_t twi_busy(void);
+uint8_t twi_start_rd(uint8_t twi_addr, uint8_t *twi_data, uint8_t byte_cnt);
+uint8_t lm73_sample(void (*done)(uint8_t status));
+uint8_t get_int_status(si4734_done_t done);
+uint8_t fm_pwr_up(si4734_done_t done);
+uint8_t fm_tune_freq(si4734_done_t done);
+
+extern volatile uint8_t       segment_data[5];
+extern const uint8_t          dec_to_7seg[13];
+extern volatile ClockMode     clock_mode;
+extern volatile Time          my_alarm;
+extern volatile uint32_t      clock_seconds;
+extern uint32_t               clock_frac_step;
+extern volatile TimeSelection time_select __asm__("time"); //clashes with time()
+extern volatile uint16_t      encoder_freq, current_fm_freq;
+extern uint16_t               current_am_freq, current_sw_freq;
+extern volatile enum radio_band current_radio_band;
+extern alarm_t                alarms[ALARM_COUNT];
+extern uint8_t                alarm_sel;
+extern uint16_t               alarm_next;
+extern volatile bool          alarm_engaged, alarm_armed;
+extern const char            *alarm_text;
+extern uint8_t                button_state;
+extern const int8_t           quad_table[16];
+extern volatile uint8_t       encoder_errors;
+extern uint8_t                button_press, button_release, button_long, button_repeat;
+extern volatile uint8_t       input_lost;
+extern RadioSeek              radio_seek_req;
+
+#define OCR3A_REG (*(volatile uint16_t *)&sim_io[0x86])
+#define EIMSK_REG (*(volatile uint8_t *)&sim_io[0x59])
+#define SIM_TICK_CYCLES 16384 //one TIMER2 tick at 16 MHz
+
+static unsigned failures;
+static int      perf_fd = -1;
+
+void sim_finish(void){exit(failures ? 1 : 0);}
+
+#define CHECK(cond, ...) do { if (!(cond)) { \
+  if (failures++ < 10) {printf("FAIL %s:%d: ", __func__, __LINE__); \
+                        printf(__VA_ARGS__); putchar('\n');} } } while (0)
+
+//******************************************************************************
+//                                  timing
+//******************************************************************************
+typedef struct {
+  double   ns;
+  double   instructions;   //negative when perf counters are unavailable
+  double   accesses;       //simulated register accesses
+} cost_t;
+
+static void perf_open(void){
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  perf_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t now_ns(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static cost_t measure(void (*body)(uint32_t i)){
+  cost_t c;
+  uint64_t instr = 0, start_cycles = sim_cycles, t0;
+
+  if (perf_fd >= 0) {ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0); ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);}
+  t0 = now_ns();
+  for (uint32_t i = 0; i < RUNS; i++) body(i);
+  c.ns = (double)(now_ns() - t0) / RUNS;
+  if (perf_fd >= 0) {
+    ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(perf_fd, &instr, sizeof(instr)) != sizeof(instr)) instr = 0;
+  }
+  c.instructions = perf_fd >= 0 ? (double)instr / RUNS : -1;
+  c.accesses = (double)(sim_cycles - start_cycles) / SIM_ACCESS_CYCLES / RUNS;
+  return c;
+}
+
+static void report(const char *name, cost_t c){
+  if (c.instructions >= 0)
+    printf("%-15s %9.1f ns %9.1f instr %7.2f reg accesses\n", name, c.ns, c.instructions, c.accesses);
+  else
+    printf("%-15s %9.1f ns %9s instr %7.2f reg accesses\n", name, c.ns, "-", c.accesses);
+}
+
+//******************************************************************************
+//                                  segsum
+//******************************************************************************
+//packed BCD of n < 10000, the slow way
+static uint16_t bcd(uint16_t n){
+  return n / 1000 << 12 | n / 100 % 10 << 8 | n / 10 % 10 << 4 | n % 10;
+}
+
+static void check_segsum(void){
+  for (uint8_t radio = 0; radio < 2; radio++) {
+    clock_mode = radio ? RADIO_MODE : TIME_MODE;
+    for (uint16_t n = 0; n < 10000; n++) {
+      uint8_t d0 = dec_to_7seg[n % 10],         d1 = dec_to_7seg[n / 10 % 10];
+      uint8_t d2 = dec_to_7seg[n / 100 % 10],   d3 = dec_to_7seg[n / 1000];
+      if (radio) {
+        d1 &= 0x7F;                               //decimal point
+        if (d3 == dec_to_7seg[0]) d3 = dec_to_7seg[10]; //blank leading zero
+      }
+      segment_data[2] = 0x5A;
+      segsum(bcd(n));
+      CHECK(segment_data[0] == d0 && segment_data[1] == d1 &&
+            segment_data[3] == d2 && segment_data[4] == d3 &&
+            segment_data[2] == 0x5A, "segsum(%u) radio=%u", n, radio);
+    }
+  }
+  clock_mode = TIME_MODE;
+}
+
+//every time and every radio frequency the display can show
+static void check_bcd(void){
+  for (uint8_t h = 0; h < 60; h++)
+    for (uint8_t m = 0; m < 60; m++)
+      CHECK(time_to_bcd(h, m) == (bcd(h) << 8 | bcd(m)), "time_to_bcd(%u, %u)", h, m);
+  CHECK(time_to_bcd(247, 12) == 0xAA12, "time_to_bcd(247, 12) not blanked");
+  for (uint16_t f = 8800; f <= 10800; f += 10)
+    CHECK(freq_to_bcd(f) == bcd(f / 10), "freq_to_bcd(%u) = %04X", f, freq_to_bcd(f));
+}
+
+static void bench_segsum(uint32_t i){segsum((uint16_t)(i & 0x9999));}
+static void bench_time_to_bcd(uint32_t i){time_to_bcd(i % 24, i % 60);}
+static void bench_freq_to_bcd(uint32_t i){freq_to_bcd(8810 + (i % 100) * 20);}
+
+//******************************************************************************
+//                                chk_buttons
+//Debounce contract: a button flips on the 8th consecutive sample that
+//disagrees with its debounced state and reports a press or release once.
+//Held BUTTON_LONG_TICKS after the last flip the held buttons report a long
+//press, then the ones in BUTTON_REPEAT_MASK repeat every
+//BUTTON_REPEAT_TICKS. The vertical counter is checked against a per button
+//model on bouncy random input, with the exact timing checked first.
+//******************************************************************************
+static uint8_t acc_press, acc_release, acc_long, acc_repeat; //since buttons_clear()
+
+static void buttons(uint8_t raw){
+  chk_buttons(raw);
+  acc_press |= button_press;
+  acc_release |= button_release;
+  acc_long |= button_long;
+  acc_repeat |= button_repeat;
+}
+
+static void buttons_clear(void){
+  acc_press = acc_release = acc_long = acc_repeat = 0;
+}
+
+static void check_chk_buttons(void){
+  uint8_t  model = 0, count[8] = {0}, lng = 0, rpt = 0;
+  uint16_t held = 0;
+  uint32_t seed = 1;
+  uint8_t  raw = 0, bounce = 0;
+
+  for (uint8_t i = 0; i < 16; i++) buttons(0);
+  buttons_clear();
+  for (uint16_t i = 1; i <= 1000; i++) {
+    buttons(0x03);
+    CHECK(acc_press == (i >= 8 ? 0x03 : 0), "press after %u samples", i);
+    CHECK(acc_long == (i >= 8 + BUTTON_LONG_TICKS ? 0x03 : 0), "long press after %u", i);
+    CHECK(acc_repeat == (i >= 8 + BUTTON_LONG_TICKS + BUTTON_REPEAT_TICKS ? 0x02 : 0),
+          "repeat after %u", i);
+    CHECK(button_repeat == ((i - 8 - BUTTON_LONG_TICKS) % BUTTON_REPEAT_TICKS ||
+                            i < 8 + BUTTON_LONG_TICKS + BUTTON_REPEAT_TICKS ? 0 : 0x02),
+          "repeat on sample %u", i);
+  }
+  for (uint8_t i = 0; i < 5; i++) buttons(0x00); //a bounce restarts the count
+  for (uint8_t i = 1; i <= 8; i++) {
+    buttons(i == 1 ? 0x00 : 0x03);
+    CHECK(!acc_release, "release during bounce %u", i);
+  }
+  for (uint8_t i = 1; i <= 8; i++) buttons(0x00);
+  CHECK(acc_release == 0x03 && !button_state, "release");
+  buttons_clear();
+
+  for (uint32_t t = 0; t < 2000000; t++) {
+    seed = seed * 1103515245 + 12345;
+    if ((seed >> 16) % 700 == 0) {bounce = 1 << (seed >> 8 & 7); raw ^= bounce;}
+    else if (bounce && (seed >> 20) % 8) {raw ^= (seed >> 24 & 1) ? bounce : 0;}
+    else bounce = 0;
+    chk_buttons(raw);
+
+    uint8_t flip = 0;
+    for (uint8_t b = 0; b < 8; b++) {
+      if (((raw ^ model) >> b & 1) == 0) {count[b] = 0; continue;}
+      if (++count[b] == 8) {count[b] = 0; flip |= 1 << b;}
+    }
+    model ^= flip;
+    lng = rpt = 0;
+    if (flip || !model) held = 0;
+    else if (++held == BUTTON_LONG_TICKS) lng = model;
+    else if (held == BUTTON_LONG_TICKS + BUTTON_REPEAT_TICKS) {
+      held = BUTTON_LONG_TICKS;
+      rpt = model & BUTTON_REPEAT_MASK;
+    }
+    CHECK(button_state == model && button_press == (model & flip) &&
+          button_release == (~model & flip) && button_long == lng && button_repeat == rpt,
+          "random input, tick %u", t);
+    acc_long |= lng;
+    acc_repeat |= rpt;
+    if (failures) break;
+  }
+  CHECK(acc_long && acc_repeat, "random input never held a button long enough");
+  buttons_clear();
+  chk_buttons(0);
+}
+
+static void bench_chk_buttons(uint32_t i){chk_buttons((uint8_t)(i >> 4));}
+
+//******************************************************************************
+//                                 encoders
+//The transition table against the quadrature model, the decoder and its
+//acceleration on slow and fast turns, then the adjustments the input task
+//makes from the steps, in every mode.
+//******************************************************************************
+static int8_t quad_dir(uint8_t past, uint8_t now){
+  static const int8_t dir[16] = { 0, +1, -1,  0,  -1,  0,  0, +1,
+                                 +1,  0,  0, -1,   0, -1, +1,  0};
+  return dir[past << 2 | now];
+}
+
+static const uint8_t cw[4] = {0x02, 0x00, 0x01, 0x03}; //one detent, from rest at 11
+static int enc_steps[2]; //EV_ENCODER deltas drained, per encoder
+
+static void enc_collect(input_event_t ev){
+  CHECK((ev.what & 0xF0) == EV_ENCODER, "event %02X from an encoder", ev.what);
+  enc_steps[ev.what & 0x0F] += ev.delta;
+}
+
+static void enc_drain(void){
+  enc_steps[ENC_LEFT] = enc_steps[ENC_RIGHT] = 0;
+  input_drain(enc_collect);
+}
+
+//turns one encoder (shift 0 left, 2 right) by "detents", "period" ticks each,
+//and returns the steps pushed
+static int turn(uint8_t shift, int detents, uint16_t period){
+  int steps;
+  enc_drain();
+  for (int d = 0; d < abs(detents); d++)
+    for (uint8_t q = 0; q < 4; q++) {
+      uint8_t state = detents > 0 ? cw[q] : cw[(6 - q) % 4];
+      for (uint16_t t = 0; t < period / 4; t++)
+        encoder_sample((0x0F & ~(0x03 << shift)) | state << shift);
+    }
+  enc_drain();
+  steps = enc_steps[shift ? ENC_RIGHT : ENC_LEFT];
+  CHECK(!enc_steps[shift ? ENC_LEFT : ENC_RIGHT], "the other encoder moved");
+  for (uint16_t t = 0; t < 300; t++) encoder_sample(0x0F); //rest, forget the speed
+  enc_drain();
+  return steps;
+}
+
+static void check_encoders(void){
+  uint8_t errors;
+
+  for (uint8_t t = 0; t < 16; t++) {
+    uint8_t past = t >> 2, now = t & 3;
+    int8_t want = (past ^ now) == 3 ? ENC_INVALID : quad_dir(past, now);
+    CHECK(quad_table[t] == want, "quad_table[%X] = %d", t, quad_table[t]);
+  }
+
+  turn(0, 0, 0);
+  errors = encoder_errors;
+  CHECK(turn(2, 5, 100) == 5 && turn(2, -5, 100) == -5, "right, slow");
+  CHECK(turn(2, 5, 40) == 1 + 4 * 2, "right, 40 ms per detent");
+  CHECK(turn(2, -5, 8) == -(1 + 4 * 8), "right, fast");
+  CHECK(turn(0, 3, 100) == 12 && turn(0, -3, 100) == -12, "left, slow");
+  CHECK(turn(0, 3, 8) == 1 + 11 * 4, "left, fast");
+  CHECK(encoder_errors == errors, "%u invalid transitions on clean turns",
+        (uint8_t)(encoder_errors - errors));
+  //a wiggle off the detent and back is no step
+  encoder_sample(0x0B); encoder_sample(0x0F);
+  enc_drain();
+  CHECK(!enc_steps[ENC_RIGHT], "right wiggle");
+  //both bits of both encoders changing is two errors and no step
+  encoder_sample(0x00); encoder_sample(0x0F);
+  enc_drain();
+  CHECK(encoder_errors == (uint8_t)(errors + 4) && !enc_steps[ENC_LEFT] && !enc_steps[ENC_RIGHT],
+        "jumps: %u errors, steps %d %d", (uint8_t)(encoder_errors - errors),
+        enc_steps[ENC_LEFT], enc_steps[ENC_RIGHT]);
+  turn(0, 0, 0);
+  //a full ring drops events and counts them, it never wraps over unread ones
+  for (uint8_t i = 0; i < 70; i++) encoder_sample(cw[i & 3] * 5);
+  CHECK(input_lost, "full ring lost nothing");
+  enc_drain();
+  input_lost = 0;
+  turn(0, 0, 0);
+
+  OCR3A_REG = 0xF8;
+  volume_adjust(3);
+  CHECK(OCR3A_REG == 0xFF, "volume above the top: %u", OCR3A_REG);
+  OCR3A_REG = 0x08;
+  volume_adjust(-3);
+  CHECK(OCR3A_REG == 0x00, "volume below the bottom: %u", OCR3A_REG);
+
+  for (int8_t steps = -3; steps <= 3; steps++) {
+    OCR3A_REG = 0x80;
+    volume_adjust(steps);
+    CHECK(OCR3A_REG == 0x80 + 4 * steps, "volume %d", steps);
+
+    for (uint8_t m = 0; m < 4; m++) {
+      for (uint8_t sel = 0; sel < 2; sel++) {
+        clock_mode = (ClockMode)m;
+        time_select = sel ? TIME_SELECT_MINUTE : TIME_SELECT_HOUR;
+        Time edited = {0, 30, 12};
+        current_fm_freq = encoder_freq = 9990;
+        time_adjust(&edited, steps);
+
+        uint8_t edits = m == TIME_MODE || m == ALARM_MODE;
+        CHECK(edited.hour   == 12 + (edits && !sel ? steps : 0) &&
+              edited.minute == 30 + (edits &&  sel ? steps : 0),
+              "time_adjust %d mode %u sel %u", steps, m, sel);
+        CHECK(encoder_freq == 9990 + (m == RADIO_MODE ? 20 * steps : 0),
+              "time_adjust %d radio freq %u", steps, encoder_freq);
+      }
+    }
+  }
+  //band edges
+  clock_mode = RADIO_MODE;
+  current_fm_freq = encoder_freq = 8790;
+  time_adjust(NULL, -3);
+  CHECK(encoder_freq == 8750, "tuned below 87.5: %u", encoder_freq);
+  current_fm_freq = encoder_freq = 10750;
+  time_adjust(NULL, 8);
+  CHECK(encoder_freq == 10790, "tuned above 107.9: %u", encoder_freq);
+  clock_mode = TIME_MODE;
+}
+
+//both encoders turning, one quarter step per tick, drained every 8 ticks
+static void bench_encoders(uint32_t i){
+  encoder_sample(cw[i & 3] * 5);
+  if ((i & 7) == 7) input_drain(enc_collect);
+}
+
+//******************************************************************************
+//                                  clock
+//The calendar of clock_seconds against the host's gmtime(), first a week and
+//a minute apart across the whole range, every breakdown a fresh one, then a
+//second at a time across a leap day and a year's end, through the cache.
+//Then the drift trim: the parabola of the crystal, and a clock 100 ppm fast
+//or slow gaining or losing its 100 ppm.
+//******************************************************************************
+#define EPOCH_2000 946684800 //Unix time of 2000-01-01 0:00
+
+static void check_calendar(uint32_t t){
+  time_t unix_time = (time_t)t + EPOCH_2000;
+  struct tm tm;
+  const calendar_t *c;
+
+  clock_set(t);
+  c = clock_calendar();
+  gmtime_r(&unix_time, &tm);
+  CHECK(c->year == tm.tm_year + 1900 && c->month == tm.tm_mon + 1 && c->day == tm.tm_mday &&
+        c->weekday == tm.tm_wday && c->hour == tm.tm_hour && c->minute == tm.tm_min &&
+        c->second == tm.tm_sec && c->week_minute == tm.tm_wday * 1440 + tm.tm_hour * 60 + tm.tm_min,
+        "%u: %u-%u-%u wd %u %u:%u:%u", t, c->year, c->month, c->day, c->weekday, c->hour, c->minute, c->second);
+}
+
+static void check_clock(void){
+  const calendar_t *c;
+
+  for (uint64_t t = 0; t <= UINT32_MAX; t += 60 * 60 * 24 * 7 + 61) check_calendar((uint32_t)t);
+  check_calendar(UINT32_MAX);
+  check_calendar(0);
+  CHECK(clock_calendar()->weekday == 6, "2000-01-01 is a Saturday");
+
+  //2024-02-28 to 03-01 and 2024-12-31 to 2025-01-01, counted by the clock
+  for (uint32_t from = 8824 * CLOCK_DAY; from; from = from == 8824 * CLOCK_DAY ? 9131 * CLOCK_DAY : 0) {
+    clock_set(from);
+    for (uint32_t t = from; t < from + 3 * CLOCK_DAY; t++) {
+      time_t unix_time = (time_t)t + EPOCH_2000;
+      struct tm tm;
+
+      c = clock_calendar();
+      gmtime_r(&unix_time, &tm);
+      CHECK(c->year == tm.tm_year + 1900 && c->month == tm.tm_mon + 1 && c->day == tm.tm_mday &&
+            c->weekday == tm.tm_wday && c->hour == tm.tm_hour && c->minute == tm.tm_min &&
+            c->second == tm.tm_sec, "counted to %u", t);
+      clock_tick();
+    }
+  }
+
+  CHECK(clock_drift(25 * 128) == 0 && clock_drift(7 * 128) == -11016 && clock_drift(43 * 128) == -11016,
+        "parabola %d %d", clock_drift(7 * 128), clock_drift(43 * 128));
+  //n a little over the 10 s that 100 ppm comes to in 10^5 s, as the step
+  //rounds down
+  for (int32_t drift = -100000; drift <= 100000; drift += 200000) {
+    uint32_t n = 100100, counted[3] = {0}, step;
+    double want = n - (double)n * drift / 1e9, exact = 100000 * 4294967296.0 / 1e9;
+
+    clock_set(0);
+    clock_trim(drift);
+    step = drift > 0 ? -clock_frac_step : clock_frac_step;
+    CHECK(step <= exact && step >= exact * (1 - 2e-5), "drift %d: step %u for %.1f", drift, step, exact);
+    for (uint32_t i = 0; i < n; i++) counted[clock_tick()]++;
+    CHECK(clock_seconds >= want - 1 && clock_seconds <= want + 1, "drift %d: %u s for %u", drift, clock_seconds, n);
+    CHECK(counted[drift > 0 ? 0 : 2] == 10 && counted[drift > 0 ? 2 : 0] == 0, "drift %d: %u %u %u",
+          drift, counted[0], counted[1], counted[2]);
+  }
+  clock_trim(0);
+  clock_set(0);
+}
+
+static void bench_clock(uint32_t i){clock_tick(); clock_calendar();}
+
+//******************************************************************************
+//                                 ui_event
+//The UI state machine on its own, fed the events input_task() would drain.
+//******************************************************************************
+//the clock on a weekday of the first week of 2000, Sunday 0 to Saturday 6
+static void set_clock(uint8_t weekday, uint8_t hour, uint8_t minute){
+  clock_set((weekday + 1) * CLOCK_DAY + hour * 3600 + minute * 60);
+  alarm_schedule();
+}
+
+static void ev(uint8_t what, int8_t delta){ui_event((input_event_t){what, delta});}
+
+static void check_ui(void){
+  const calendar_t *c;
+
+  clock_mode = TIME_MODE;
+  set_clock(3, 12, 30);
+  my_alarm = (Time){0, 30, 12};
+  alarms[0].hour = 12;
+  alarms[0].minute = 30;
+  current_fm_freq = encoder_freq = 9990;
+  OCR3A_REG = 0x80;
+
+  ev(EV_PRESS | 7, 0);
+  CHECK(clock_mode == ALARM_MODE, "button 7: mode %u", clock_mode);
+  ev(EV_PRESS | 1, 0);
+  ev(EV_ENCODER | ENC_RIGHT, 3);
+  CHECK(my_alarm.hour == 15 && clock_calendar()->hour == 12, "alarm hour %u", my_alarm.hour);
+  ev(EV_PRESS | 2, 0);
+  ev(EV_LONG | 2, 0);
+  ev(EV_REPEAT | 2, 0);
+  ev(EV_LONG | 6, 0); //only the select buttons repeat
+  CHECK(my_alarm.minute == 32, "held minute select: %u", my_alarm.minute);
+  ev(EV_ENCODER | ENC_LEFT, -2);
+  CHECK(OCR3A_REG == 0x78, "volume %u", OCR3A_REG);
+  CHECK(alarms[0].hour == 15 && alarms[0].minute == 32, "alarm 0 %u:%u", alarms[0].hour, alarms[0].minute);
+  ev(EV_PRESS | 4, 0); //the next alarm of the table
+  ev(EV_PRESS | 1, 0);
+  ev(EV_ENCODER | ENC_RIGHT, -1); //wraps to 23
+  ev(EV_PRESS | 0, 0);
+  ev(EV_PRESS | 6, 0);
+  CHECK(alarm_sel == 1 && my_alarm.hour == 23 && alarms[1].hour == 23 && alarms[1].days == ALARM_WEEKDAYS &&
+        alarms[1].enabled && !alarm_armed, "alarm 1 %u:%u days %02X", alarms[1].hour, alarms[1].minute, alarms[1].days);
+  alarms[1] = (alarm_t){0, 0, ALARM_EVERY_DAY, 10, false};
+  for (uint8_t i = 0; i < 3; i++) {ev(EV_PRESS | 4, 0);}
+  CHECK(alarm_sel == 0 && my_alarm.hour == 15, "back to alarm 0: %u", alarm_sel);
+  ev(EV_PRESS | 7, 0);
+  ev(EV_PRESS | 3, 0);
+  CHECK(clock_mode == RADIO_MODE, "button 3: mode %u", clock_mode);
+  ev(EV_ENCODER | ENC_RIGHT, -2);
+  CHECK(encoder_freq == 9950, "tuned to %u", encoder_freq);
+  ev(EV_PRESS | 2, 0);
+  ev(EV_LONG | 2, 0); //no hold stepping in RADIO_MODE
+  CHECK(radio_seek_req == SEEK_UP && encoder_freq == 9950, "seek up: %u", radio_seek_req);
+  ev(EV_PRESS | 4, 0);
+  ev(EV_LONG | 4, 0);
+  ev(EV_RELEASE | 4, 0); //the long press was the scan, no preset
+  CHECK(radio_seek_req == SEEK_SCAN && encoder_freq == 9950, "scan: %u", radio_seek_req);
+  radio_seek_req = SEEK_NONE;
+  ev(EV_PRESS | 0, 0);
+  ev(EV_RELEASE | 0, 0); //no station index yet, so it seeks
+  CHECK(radio_seek_req == SEEK_DOWN, "preset down: %u", radio_seek_req);
+  radio_seek_req = SEEK_NONE;
+  current_am_freq = current_sw_freq = 0;
+  ev(EV_LONG | 0, 0); //to AM, on its default
+  ev(EV_RELEASE | 0, 0);
+  ev(EV_ENCODER | ENC_RIGHT, 2);
+  CHECK(current_radio_band == AM && encoder_freq == 1020 && radio_seek_req == SEEK_NONE,
+        "AM: band %u freq %u", current_radio_band, encoder_freq);
+  ev(EV_LONG | 0, 0); //to SW
+  ev(EV_ENCODER | ENC_RIGHT, -1);
+  CHECK(current_radio_band == SW && encoder_freq == 9495, "SW: band %u freq %u", current_radio_band, encoder_freq);
+  ev(EV_LONG | 0, 0); //back to FM where it was
+  CHECK(current_radio_band == FM && encoder_freq == 9950 && current_am_freq == 1020 &&
+        current_sw_freq == 9495, "FM: band %u freq %u", current_radio_band, encoder_freq);
+  ev(EV_RELEASE | 0, 0);
+  //a scan result below 88.1 is in the band for the index, the band round
+  //trip and the knob alike
+  current_fm_freq = encoder_freq = 8770; //as radio_seek_finish() leaves it
+  station_clear();
+  station_add(8770, 45, 35);
+  CHECK(station_next(9950, 1) == 8770, "preset 87.7: %u", station_next(9950, 1));
+  for (uint8_t i = 0; i < 3; i++) {ev(EV_LONG | 0, 0); ev(EV_RELEASE | 0, 0);}
+  CHECK(current_radio_band == FM && encoder_freq == 8770, "87.7 after AM and SW: band %u freq %u",
+        current_radio_band, encoder_freq);
+  ev(EV_ENCODER | ENC_RIGHT, -1);
+  CHECK(encoder_freq == 8750, "down from 87.7: %u", encoder_freq);
+  station_clear();
+  current_fm_freq = encoder_freq = 9950;
+  ev(EV_PRESS | 3, 0);
+  ev(EV_PRESS | 5, 0);
+  CHECK(clock_mode == SNOOZE_MODE, "snooze");
+  ev(EV_PRESS | 5, 0);
+  CHECK(clock_mode == TIME_MODE, "snooze off");
+  ev(EV_PRESS | 2, 0);
+  set_clock(3, 12, 58);
+  ev(EV_ENCODER | ENC_RIGHT, 3); //a step at a time, wrapping at 59
+  c = clock_calendar();
+  CHECK(c->minute == 1 && c->hour == 12 && c->weekday == 3, "minute wrapped to %u:%u", c->hour, c->minute);
+  ev(EV_PRESS | 1, 0);
+  ev(EV_ENCODER | ENC_RIGHT, 12); //and the hour at 23, on the same day
+  c = clock_calendar();
+  CHECK(c->hour == 0 && c->minute == 1 && c->weekday == 3, "hour wrapped to %u:%u", c->hour, c->minute);
+  ev(EV_PRESS | 4, 0); //a day on
+  CHECK(clock_calendar()->weekday == 4 && clock_calendar()->day == 6, "day on: %u", clock_calendar()->weekday);
+  for (uint8_t i = 0; i < 7; i++) ev(EV_PRESS | 0, 0); //back, not before 2000-01-01
+  c = clock_calendar();
+  CHECK(c->year == 2000 && c->day == 1 && c->hour == 0 && c->minute == 1, "day back to %u-%u", c->month, c->day);
+}
+
+//******************************************************************************
+//                               alarm_handler
+//Every alarm time against every clock time, armed and disarmed; then the
+//weekday masks, several alarms, the end of the ringing minute and a snooze.
+//******************************************************************************
+static void check_alarm_handler(void){
+  alarm_t saved[ALARM_COUNT];
+
+  memcpy(saved, alarms, sizeof(saved));
+  for (uint8_t i = 1; i < ALARM_COUNT; i++) alarms[i].enabled = false;
+  alarms[0] = (alarm_t){0, 0, ALARM_EVERY_DAY, 10, true};
+  clock_mode = TIME_MODE;
+  for (uint16_t a = 0; a < 24 * 60; a++) {
+    alarms[0].hour = a / 60;
+    alarms[0].minute = a % 60;
+    for (uint16_t t = 0; t < 24 * 60; t++) {
+      set_clock(3, t / 60, t % 60);
+      alarm_handler(true);
+      CHECK(alarm_engaged == (a == t), "armed alarm %u time %u", a, t);
+      CHECK(!strcmp(alarm_text, a == t ? "TIME TO RISE" : "ALARM:ON"), "text %s", alarm_text);
+      alarm_handler(false);
+      CHECK(!alarm_engaged, "disarmed alarm %u time %u", a, t);
+    }
+  }
+
+  //weekdays only: Friday 7:00 rings, Saturday's is skipped for Monday's
+  alarms[0] = (alarm_t){7, 0, ALARM_WEEKDAYS, 10, true};
+  set_clock(5, 6, 59);
+  CHECK(alarm_next == 5 * 1440 + 420, "next after Friday 6:59: %u", alarm_next);
+  set_clock(5, 7, 1);
+  CHECK(alarm_next == 1 * 1440 + 420, "next after Friday 7:01: %u", alarm_next);
+  set_clock(6, 7, 0);
+  alarm_handler(true);
+  CHECK(!alarm_engaged, "rang on Saturday");
+
+  //the earlier of two; the minute running out of 23:59 on Saturday into Sunday
+  alarms[1] = (alarm_t){0, 0, ALARM_EVERY_DAY, 5, true};
+  set_clock(6, 23, 59);
+  for (uint8_t s = 0; s < 60; s++) clock_tick();
+  const calendar_t *c = clock_calendar();
+  CHECK(c->weekday == 0 && c->hour == 0 && c->minute == 0, "midnight %u %u:%u",
+        c->weekday, c->hour, c->minute);
+  alarm_handler(true);
+  CHECK(alarm_engaged, "alarm 1 at Sunday 0:00");
+
+  //snooze: quiet, then again 5 minutes later; the minute over moves it on
+  ev(EV_PRESS | 5, 0);
+  alarm_handler(true);
+  CHECK(!alarm_engaged && alarm_next == 5, "snoozed to %u", alarm_next);
+  for (uint16_t s = 0; s < 5 * 60; s++) clock_tick();
+  alarm_handler(true);
+  CHECK(alarm_engaged, "snooze over");
+  for (uint8_t s = 0; s < 60; s++) clock_tick();
+  alarm_handler(true);
+  CHECK(!alarm_engaged && alarm_next == 1440, "after the snooze: %u", alarm_next);
+  ev(EV_PRESS | 5, 0); //out of SNOOZE_MODE
+  CHECK(clock_mode == TIME_MODE && alarm_next == 1440, "snooze off: %u", alarm_next);
+
+  memcpy(alarms, saved, sizeof(saved));
+  alarm_schedule();
+}
+
+static void bench_alarm_handler(uint32_t i){alarm_handler(i & 1);}
+
+//******************************************************************************
+//                                   lm73
+//Every 14 bit reading over the LM73's -40 to 150 C range converts to the
+//nearest tenth of a degree C and F and formats as such; the filter settles
+//on a step without a residual error.
+//******************************************************************************
+static int32_t floor_div(int32_t a, int32_t b){return a >= 0 ? a / b : -((-a + b - 1) / b);}
+
+//the text of "tenths" in four characters at most, as LCD line 2 has room for
+static void temp_text(char *text, int32_t tenths){
+  int32_t a = labs(tenths);
+
+  if (a / 10 >= (tenths < 0 ? 10 : 100)) {sprintf(text, "%s%d", tenths < 0 ? "-" : "", (int)((a + 5) / 10));}
+  else {sprintf(text, "%s%d.%d", tenths < 0 ? "-" : "", (int)(a / 10), (int)(a % 10));}
+}
+
+static void check_lm73(void){
+  char have[8], want[8];
+
+  for (int32_t r = -40 * 128; r <= 150 * 128; r += 4) {
+    int32_t c = floor_div(r * 10 + 64, 128), f = floor_div(r * 18 + 64, 128) + 320;
+    CHECK(lm73_tenths((uint16_t)r, 0) == c && lm73_tenths((uint16_t)r, 1) == f,
+          "lm73_tenths(%d) = %d C %d F", (int)r, lm73_tenths((uint16_t)r, 0), lm73_tenths((uint16_t)r, 1));
+    for (uint8_t unit = 0; unit < 2; unit++) {
+      temp_text(want, unit ? f : c);
+      CHECK(lm73_temp_convert(have, (uint16_t)r, unit) == strlen(want) && !strcmp(have, want) && strlen(have) <= 4,
+            "lm73_temp_convert(%d, %s) = %s", (int)r, unit ? "F" : "C", have);
+    }
+  }
+  //the five-character readings of the one-decimal format
+  lm73_temp_convert(have, (uint16_t)(int16_t)(-10.5 * 128), 0);
+  CHECK(!strcmp(have, "-11"), "-10.5 C: %s", have);
+  lm73_temp_convert(have, 100 * 128, 0);
+  CHECK(!strcmp(have, "100"), "100.0 C: %s", have);
+  lm73_temp_convert(have, 40 * 128, 1);
+  CHECK(!strcmp(have, "104"), "104.0 F: %s", have);
+  lm73_temp_convert(have, (uint16_t)(int16_t)(-3 * 128), 0);
+  CHECK(!strcmp(have, "-3.0"), "-3.0 C: %s", have);
+  lm73_filter(20 * 128); //seeds
+  uint16_t last = 20 * 128, now = 0;
+  for (uint8_t i = 0; i < 40; i++) {
+    now = lm73_filter(25 * 128);
+    CHECK(now >= last, "lm73_filter went back: %u", now);
+    last = now;
+  }
+  CHECK(now == 25 * 128, "lm73_filter settled on %u", now);
+}
+
+//******************************************************************************
+//                                  si4734
+//Tunes one after the other on the TWI and Si4734 models. Each must end on
+//its STC: a tune that leaves STCINT set gets no INT7 pulse for the next one,
+//which then only ends on the SI4734_STC_TICKS timeout. A command the full
+//queue refuses must still reach its callback.
+//******************************************************************************
+static volatile int16_t si_done_status;
+
+static void si_done(uint8_t status){si_done_status = status;}
+
+//TIMER2 ticks until the command finishes, -1 if it never does
+static int16_t si_run(void){
+  for (int16_t ticks = 1; ticks <= 2 * SI4734_STC_TICKS; ticks++) {
+    sim_delay_cycles(SIM_TICK_CYCLES);
+    si4734_tick();
+    if (si_done_status >= 0) {return ticks;}
+  }
+  return -1;
+}
+
+static void check_si4734(void){
+  int16_t ticks;
+
+  init_twi();
+  EIMSK_REG |= 0x80; //INT7
+  sim_sei();
+  si_done_status = -1;
+  fm_pwr_up(si_done);
+  ticks = si_run();
+  CHECK(ticks > 0 && si_done_status == 0, "power up: status %d after %d ticks", si_done_status, ticks);
+  for (uint8_t i = 0; i < 3; i++) {
+    current_fm_freq = 9470 + 20 * i;
+    si_done_status = -1;
+    fm_tune_freq(si_done);
+    ticks = si_run();
+    CHECK(ticks > 0 && ticks < SI4734_STC_TICKS && si_done_status == 0,
+          "tune %u: status %d after %d ticks", i, si_done_status, ticks);
+  }
+
+  sim_cli(); //nothing leaves the queue meanwhile
+  for (uint8_t i = 0; i < SI4734_QUEUE_SIZE - 3; i++) {CHECK(get_int_status(NULL), "queue full at %u", i);}
+  si_done_status = -1; //room for two, the power up and its profile are three
+  CHECK(!fm_pwr_up(si_done) && si_done_status == SI4734_OVERFLOW, "power up with two free: status %d", si_done_status);
+  CHECK(get_int_status(NULL) && get_int_status(NULL), "a refused power up was queued in part");
+  si_done_status = -1;
+  CHECK(!fm_tune_freq(si_done), "tune queued on a full queue");
+  CHECK(si_done_status == SI4734_OVERFLOW, "tune on a full queue: status %d", si_done_status);
+  sim_sei();
+  for (uint16_t t = 0; si4734_busy() && t < 1000; t++) {sim_delay_cycles(SIM_TICK_CYCLES); si4734_tick();}
+  CHECK(!si4734_busy(), "queue not drained");
+  sim_cli();
+}
+
+//the LM73's pointer write, read and next one shot go out together or not at
+//all, so a read never goes missing behind its pointer write
+static void check_lm73_sample(void){
+  uint8_t sink[2];
+
+  init_twi();
+  while (twi_room() > 2) {twi_start_rd(0x99, sink, 2);} //nobody answers at 0x4C
+  CHECK(!lm73_sample(NULL) && twi_room() == 2, "lm73_sample with two free: room %u", twi_room());
+  twi_start_rd(0x99, sink, 2);
+  CHECK(!lm73_sample(NULL) && twi_room() == 1, "lm73_sample with one free: room %u", twi_room());
+  sim_sei();
+  for (uint16_t t = 0; twi_busy() && t < 1000; t++) {sim_delay_cycles(SIM_TICK_CYCLES);}
+  CHECK(!twi_busy(), "TWI queue not drained");
+  CHECK(lm73_sample(NULL) && twi_room() >= 4, "lm73_sample on an empty queue: room %u", twi_room());
+  for (uint16_t t = 0; twi_busy() && t < 1000; t++) {sim_delay_cycles(SIM_TICK_CYCLES);}
+  sim_cli();
+}
+
+static void bench_lm73(uint32_t i){char t[8]; lm73_temp_convert(t, (uint16_t)(i & 0x7FFC), i & 1);}
+
+int main(void){
+  sim_periph_init();
+  perf_open();
+
+  check_segsum();
+  check_bcd();
+  check_chk_buttons();
+  check_encoders();
+  spi_init();    //button 3 and 7 clear the LCD
+  tcnt1_init();
+  check_clock();
+  check_ui();
+  check_alarm_handler();
+  check_lm73();
+  check_si4734();
+  check_lm73_sample();
+
+  report("segsum",        measure(bench_segsum));
+  report("time_to_bcd",   measure(bench_time_to_bcd));
+  report("freq_to_bcd",   measure(bench_freq_to_bcd));
+  report("chk_buttons",   measure(bench_chk_buttons));
+  report("encoders",      measure(bench_encoders));
+  report("alarm_handler", measure(bench_alarm_handler));
+  report("clock",         measure(bench_clock));
+  report("lm73_convert",  measure(bench_lm73));
+
+  printf("%s (%u failures)\n", failures ? "FAILED" : "all checks passed", failures);
+  return failures ? 1 : 0;
+}
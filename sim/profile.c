@@ -0,0 +1,270 @@
+//profile.c
+//Cycle accurate ISR profiler (make profile). Runs the unmodified lab4.elf in
+//simavr's ATmega128 core and timestamps the entry and reti of every vector
+//through simavr's per-vector interrupt IRQs, then reports per-ISR min, mean
+//and max cycles, the worst latency from flag to entry, the longest stretch
+//with interrupts blocked by an ISR and a histogram of TIMER1_COMPA jitter.
+//
+//The TWI bus gets a minimal LM73 and Si4734 so the radio runs as on the
+//board: both addresses ACK and the LM73 returns 22 C. An Si4734 tune
+//completes 60 ms later and a seek a little later still, 1 MHz on, or at the
+//band edge with BLTF set. Either sets STCINT. As on the chip, STCINT stays
+//set until a TUNE_STATUS with INTACK, and INT7 (PE7) pulses only when
+//STCINT goes from 0 to 1. TUNE_STATUS reads back the frequency.
+//
+//TODO: UNTESTED! Written to simavr's API, but never built against simavr
+//or run; only its syntax has been checked. Treat its numbers with care
+//until it has been run next to a known profile.
+//
+//usage: profile lab4.elf [seconds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_irq.h>
+#include <simavr/sim_interrupts.h>
+#include <simavr/sim_cycle_timers.h>
+#include <simavr/avr_ioport.h>
+#include <simavr/avr_twi.h>
+
+#define F_CPU        16000000UL
+#define JITTER_BINS   16                              //histogram bins
+#define JITTER_BIN_US 2                               //bin width
+#define JITTER_BIN    (JITTER_BIN_US * (F_CPU / 1000000UL)) //in cycles
+
+#define SI4734_ADDRESS 0x22
+#define LM73_ADDRESS   0x90
+#define SI_BAND_BOTTOM 8750   //FM, 10 kHz units
+#define SI_BAND_TOP    10790
+#define SI_SEEK_STEP   100    //1 MHz a seek
+
+typedef struct {
+  uint8_t      vector;
+  const char  *name;
+  uint64_t     calls;
+  avr_cycle_count_t min, max, total;
+  avr_cycle_count_t max_latency;  //flag raised to vector entered
+  avr_cycle_count_t pending_at, entered_at, last_entry;
+} isr_prof_t;
+
+static isr_prof_t isrs[] = {
+  { 8, "INT7"},
+  {10, "TIMER2_OVF"},
+  {12, "TIMER1_COMPA"},
+  {13, "TIMER1_COMPB"},
+  {16, "TIMER0_OVF"},
+  {17, "SPI_STC"},
+  {19, "USART0_UDRE"},
+  {21, "ADC"},
+  {22, "EE_READY"},
+  {33, "TWI"},
+};
+#define NUM_ISRS (sizeof(isrs) / sizeof(isrs[0]))
+
+static avr_t   *avr;
+static uint64_t jitter[JITTER_BINS + 1];   //last bin collects the overflow
+static avr_cycle_count_t jitter_max;
+
+//******************************************************************************
+//                          vector entry and exit
+//******************************************************************************
+static void isr_pending(struct avr_irq_t *irq, uint32_t value, void *param){
+  isr_prof_t *p = param;
+  if (value) p->pending_at = avr->cycle;
+}
+
+//expected TIMER1_COMPA period from OCR1A and the TCCR1B prescaler
+static avr_cycle_count_t timer1_period(void){
+  static const uint16_t prescale[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+  uint16_t ocr1a = avr->data[0x4A] | (avr->data[0x4B] << 8);
+  return (ocr1a + 1ULL) * prescale[avr->data[0x4E] & 0x07];
+}
+
+static void isr_running(struct avr_irq_t *irq, uint32_t value, void *param){
+  isr_prof_t *p = param;
+  avr_cycle_count_t now = avr->cycle, d;
+
+  if (value) { //entry
+    if (p->pending_at && now - p->pending_at > p->max_latency)
+      p->max_latency = now - p->pending_at;
+    if (p->vector == 12 && p->last_entry) {
+      avr_cycle_count_t period = timer1_period(), gap = now - p->last_entry;
+      d = gap > period ? gap - period : period - gap;
+      if (d > jitter_max) jitter_max = d;
+      jitter[d / JITTER_BIN < JITTER_BINS ? d / JITTER_BIN : JITTER_BINS]++;
+    }
+    p->entered_at = p->last_entry = now;
+    p->pending_at = 0;
+    return;
+  }
+  //reti
+  d = now - p->entered_at;
+  if (!p->calls || d < p->min) p->min = d;
+  if (d > p->max) p->max = d;
+  p->total += d;
+  p->calls++;
+}
+
+//******************************************************************************
+//                             TWI slave stubs
+//******************************************************************************
+static avr_irq_t *twi_in;
+static uint8_t    twi_selected, twi_cmd[8], twi_len, twi_read_idx;
+static uint8_t    si_resp[8], si_resp_len, si_stc, si_bltf;
+static uint16_t   si_freq = SI_BAND_BOTTOM;
+
+static avr_cycle_count_t stc_release(avr_t *avr, avr_cycle_count_t when, void *param){
+  avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('E'), 7), 0);
+  return 0;
+}
+
+//the end of a tune or seek: STCINT, and the pulse if it was clear
+static avr_cycle_count_t stc_pulse(avr_t *avr, avr_cycle_count_t when, void *param){
+  uint8_t rising = !si_stc;
+
+  si_stc = 1;
+  if (!rising) return 0;
+  avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('E'), 7), 1);
+  avr_cycle_timer_register_usec(avr, 2, stc_release, NULL);
+  return 0;
+}
+
+//a command written to the Si4734; sets up what a read returns
+static void si_command(void){
+  si_resp_len = 0;
+  switch (twi_cmd[0]) {
+    case 0x01: si_stc = 0; break; //power up
+    case 0x20:
+    case 0x40:
+      if (twi_len >= 4) si_freq = twi_cmd[2] << 8 | twi_cmd[3];
+      si_bltf = 0;
+      avr_cycle_timer_register_usec(avr, 60000, stc_pulse, NULL);
+      break;
+    case 0x21: { //seek: stops at the band edge with BLTF unless IN_WRAP
+      int up = twi_cmd[1] & 0x08, wrap = twi_cmd[1] & 0x04;
+      int edge = up ? si_freq + SI_SEEK_STEP > SI_BAND_TOP : si_freq < SI_BAND_BOTTOM + SI_SEEK_STEP;
+      si_bltf = edge && !wrap;
+      if (!edge)     si_freq = up ? si_freq + SI_SEEK_STEP : si_freq - SI_SEEK_STEP;
+      else if (wrap) si_freq = up ? SI_BAND_BOTTOM : SI_BAND_TOP;
+      else           si_freq = up ? SI_BAND_TOP : SI_BAND_BOTTOM;
+      avr_cycle_timer_register_usec(avr, 85000, stc_pulse, NULL);
+      break;
+    }
+    case 0x22:
+    case 0x42:
+      if (twi_len >= 2 && (twi_cmd[1] & 0x01)) si_stc = 0; //INTACK
+      si_resp[1] = 0x01 | (si_bltf ? 0x80 : 0x00);           //VALID, BLTF
+      si_resp[2] = si_freq >> 8;
+      si_resp[3] = (uint8_t)si_freq;
+      si_resp[4] = 40;                                        //RSSI
+      si_resp[5] = 30;                                        //SNR
+      si_resp[6] = si_resp[7] = 0;
+      si_resp_len = 8;
+      break;
+  }
+}
+
+static void twi_hook(struct avr_irq_t *irq, uint32_t value, void *param){
+  avr_twi_msg_irq_t v;
+  v.u.v = value;
+
+  if (v.u.twi.msg & TWI_COND_STOP) {
+    if (twi_selected == SI4734_ADDRESS && twi_len) {si_command(); twi_len = 0;}
+    twi_selected = 0;
+  }
+  if (v.u.twi.msg & TWI_COND_START) {
+    uint8_t addr = v.u.twi.addr & 0xFE;
+    twi_selected = 0;
+    if (addr == SI4734_ADDRESS || addr == LM73_ADDRESS) {
+      twi_selected = addr;
+      twi_read_idx = 0;
+      if (!(v.u.twi.addr & 0x01)) twi_len = 0;
+      avr_raise_irq(twi_in, avr_twi_irq_msg(TWI_COND_ACK, twi_selected, 1));
+    }
+  }
+  if (!twi_selected) return;
+  if (v.u.twi.msg & TWI_COND_WRITE) {
+    if (twi_len < sizeof(twi_cmd)) twi_cmd[twi_len++] = v.u.twi.data;
+    avr_raise_irq(twi_in, avr_twi_irq_msg(TWI_COND_ACK, twi_selected, 1));
+  }
+  if (v.u.twi.msg & TWI_COND_READ) {
+    uint8_t data = 0x80 | si_stc; //Si4734: CTS and STCINT, then the response
+    if (twi_selected == SI4734_ADDRESS && twi_read_idx && twi_read_idx < si_resp_len)
+      data = si_resp[twi_read_idx];
+    if (twi_selected == LM73_ADDRESS) data = twi_read_idx ? 0x00 : 0x0B; //22 C
+    twi_read_idx++;
+    avr_raise_irq(twi_in, avr_twi_irq_msg(TWI_COND_READ, twi_selected, data));
+  }
+}
+
+//******************************************************************************
+//                                  report
+//******************************************************************************
+static void report(double seconds){
+  avr_cycle_count_t blocking = 0;
+  const char *blocker = "-";
+
+  printf("profile %.3f s, %llu cycles\n", seconds, (unsigned long long)avr->cycle);
+  printf("%-13s %10s %9s %9s %9s %12s\n", "vector", "calls", "min cyc",
+         "mean cyc", "max cyc", "max latency");
+  for (unsigned i = 0; i < NUM_ISRS; i++) {
+    isr_prof_t *p = &isrs[i];
+    printf("%-13s %10llu %9llu %9llu %9llu %12llu\n", p->name,
+           (unsigned long long)p->calls, (unsigned long long)p->min,
+           (unsigned long long)(p->calls ? p->total / p->calls : 0),
+           (unsigned long long)p->max, (unsigned long long)p->max_latency);
+    if (p->max > blocking) {blocking = p->max; blocker = p->name;}
+  }
+  printf("worst case blocking %llu cycles (%.1f us) in %s\n",
+         (unsigned long long)blocking, blocking * 1e6 / F_CPU, blocker);
+
+  printf("TIMER1_COMPA jitter, period %llu cycles, worst %llu cycles (%.1f us)\n",
+         (unsigned long long)timer1_period(), (unsigned long long)jitter_max,
+         jitter_max * 1e6 / F_CPU);
+  uint64_t peak = 1;
+  for (int b = 0; b <= JITTER_BINS; b++) if (jitter[b] > peak) peak = jitter[b];
+  for (int b = 0; b <= JITTER_BINS; b++) {
+    int bar = (int)(jitter[b] * 50 / peak);
+    if (b < JITTER_BINS) printf("  %3d-%3d us ", b * JITTER_BIN_US, (b + 1) * JITTER_BIN_US);
+    else                 printf("     >%3d us ", JITTER_BINS * JITTER_BIN_US);
+    printf("%10llu ", (unsigned long long)jitter[b]);
+    while (bar--) putchar('#');
+    putchar('\n');
+  }
+}
+
+int main(int argc, char *argv[]){
+  elf_firmware_t fw;
+  double seconds = argc > 2 ? atof(argv[2]) : 10.0;
+  avr_cycle_count_t end;
+
+  if (argc < 2) {fprintf(stderr, "usage: %s lab4.elf [seconds]\n", argv[0]); return 2;}
+  memset(&fw, 0, sizeof(fw));
+  if (elf_read_firmware(argv[1], &fw)) {fprintf(stderr, "cannot read %s\n", argv[1]); return 1;}
+  strcpy(fw.mmcu, "atmega128");
+  fw.frequency = F_CPU;
+
+  avr = avr_make_mcu_by_name(fw.mmcu);
+  if (!avr) {fprintf(stderr, "simavr has no atmega128 core\n"); return 1;}
+  avr_init(avr);
+  avr_load_firmware(avr, &fw);
+
+  for (unsigned i = 0; i < NUM_ISRS; i++) {
+    avr_irq_t *irq = avr_get_interrupt_irq(avr, isrs[i].vector);
+    avr_irq_register_notify(irq + AVR_INT_IRQ_PENDING, isr_pending, &isrs[i]);
+    avr_irq_register_notify(irq + AVR_INT_IRQ_RUNNING, isr_running, &isrs[i]);
+  }
+  twi_in = avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_INPUT);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_OUTPUT),
+                          twi_hook, NULL);
+
+  end = (avr_cycle_count_t)(seconds * F_CPU);
+  while (avr->cycle < end) {
+    int state = avr_run(avr);
+    if (state == cpu_Done || state == cpu_Crashed) break;
+  }
+  report((double)avr->cycle / F_CPU);
+  return 0;
+}
@@ -0,0 +1,211 @@
+//replay.c
+//Deterministic replay of an input trace (make replay). The trace comes from a
+//DEFS=-DINPUT_TRACE build, either over the board's USART0 or from the host
+//simulation (lab4_sim -T trace.bin); input_trace.h describes the format.
+//
+//Every recorded tick sets the PINA button byte and feeds the encoder nibble
+//through the firmware's own samplers (button_sample(), encoder_sample()),
+//which push input events, and input_task(), which drains them through the
+//UI state machine, linked from the sim build. Recorded seconds count
+//clock_seconds on and recorded tunes set the frequency of the current band,
+//so the state follows the session exactly. A seek, scan or preset sets
+//encoder_freq from a record of its own, as the replay has no radio. The
+//checkpoint right after the header, the band frequencies and the alarm
+//table after it are the state at reset, which the replay starts from. Every later
+//one is compared with the replayed clock_mode, clock_seconds, my_alarm,
+//encoder_freq and band; a mismatch means the input path no longer reacts to the same
+//inputs the same way (e.g. a missed detent).
+//
+//usage: replay trace.bin [-v]
+//  -v  print every checkpoint, not only the ones that differ
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <avr/io.h>
+
+#include "sim.h"
+#include "../time.h"
+#undef  INPUT_TRACE //only the record format, not the recorder
+#include "../input_trace.h"
+
+#define CHECKPOINT_BYTES 10
+
+//firmware under test
+void spi_init(void);
+void tcnt1_init(void);
+void button_sample(void);
+void encoder_sample(uint8_t encoder);
+void input_task(void);
+
+extern volatile ClockMode clock_mode;
+extern volatile Time      my_alarm;
+extern volatile uint32_t  clock_seconds;
+void clock_set(uint32_t seconds);
+extern volatile uint16_t  encoder_freq, current_fm_freq;
+enum radio_band {FM, AM, SW};                 //as in globals.h
+extern volatile enum radio_band current_radio_band;
+extern uint16_t           current_am_freq, current_sw_freq;
+void band_freq_set(uint8_t band, uint16_t freq);
+
+#define ALARM_COUNT 4                          //as in alarms.h
+typedef struct {uint8_t hour, minute, days, snooze, enabled;} alarm_t;
+extern alarm_t alarms[ALARM_COUNT];
+
+static uint64_t ticks, seconds, checkpoints, mismatches, lost;
+static int      verbose;
+
+void sim_finish(void){exit(2);} //the replay never sets a time limit
+
+static void tick(uint8_t pins, uint8_t nibble){
+  sim_set_buttons(~pins); //PINA reads back the recorded byte
+  button_sample();
+  encoder_sample(nibble);
+  input_task();           //run on every tick
+  ticks++;
+}
+
+static uint32_t clock_of(const uint8_t s[CHECKPOINT_BYTES]){
+  return s[1] | s[2] << 8 | (uint32_t)s[3] << 16 | (uint32_t)s[4] << 24;
+}
+
+static void state(uint8_t s[CHECKPOINT_BYTES]){
+  s[0] = clock_mode;
+  for (int b = 0; b < 4; b++) s[1 + b] = (uint8_t)(clock_seconds >> 8 * b);
+  s[5] = my_alarm.hour;
+  s[6] = my_alarm.minute;
+  s[7] = (uint8_t)encoder_freq;
+  s[8] = (uint8_t)(encoder_freq >> 8);
+  s[9] = current_radio_band;
+}
+
+static void restore(const uint8_t s[CHECKPOINT_BYTES]){
+  clock_mode     = s[0];
+  clock_set(clock_of(s));  //drops the calendar of the last run
+  my_alarm.hour  = s[5];
+  my_alarm.minute = s[6];
+  encoder_freq   = s[7] | s[8] << 8;
+  current_radio_band = s[9];
+}
+
+static void print_state(const char *label, const uint8_t s[CHECKPOINT_BYTES]){
+  uint32_t t = clock_of(s);
+  printf("%s mode %u day %u time %02u:%02u:%02u alarm %02u:%02u freq %u band %u\n", label,
+         s[0], (unsigned)(t / 86400), (unsigned)(t / 3600 % 24), (unsigned)(t / 60 % 60),
+         (unsigned)(t % 60), s[5], s[6], s[7] | s[8] << 8, s[9]);
+}
+
+static void checkpoint(const uint8_t *want){
+  uint8_t have[CHECKPOINT_BYTES];
+  state(have);
+  checkpoints++;
+  if (!memcmp(have, want, CHECKPOINT_BYTES)) {
+    if (verbose) {printf("tick %-10llu ", (unsigned long long)ticks); print_state("ok  ", have);}
+    return;
+  }
+  if (mismatches++ < 10) {
+    printf("tick %-10llu ", (unsigned long long)ticks); print_state("want", want);
+    printf("%-15s ", "");                                print_state("have", have);
+  }
+}
+
+static uint8_t *load(const char *path, size_t *size){
+  FILE *f = fopen(path, "rb");
+  uint8_t *buf;
+  long n;
+  if (!f) {perror(path); exit(2);}
+  fseek(f, 0, SEEK_END);
+  n = ftell(f);
+  rewind(f);
+  buf = malloc(n > 0 ? n : 1);
+  if (!buf || fread(buf, 1, n, f) != (size_t)n) {fprintf(stderr, "cannot read %s\n", path); exit(2);}
+  fclose(f);
+  *size = n;
+  return buf;
+}
+
+int main(int argc, char *argv[]){
+  uint8_t pins = 0x00, nibble = 0, final[CHECKPOINT_BYTES];
+  size_t  size, i = 4;
+  uint8_t *trace;
+  clock_t start;
+  double  host;
+  bool    truncated = false;
+
+  if (argc < 2) {fprintf(stderr, "usage: %s trace.bin [-v]\n", argv[0]); return 2;}
+  verbose = argc > 2 && !strcmp(argv[2], "-v");
+  trace = load(argv[1], &size);
+  if (size < 4 || memcmp(trace, "L4T3", 4)) {fprintf(stderr, "%s is not an input trace\n", argv[1]); return 2;}
+
+  sim_periph_init();
+  spi_init();    //button_handler() clears the LCD on mode changes,
+  tcnt1_init();  //which the LCD queue paces from TIMER1
+  DDRA  = 0x00;  //as the TIMER2 ISR leaves them for the buttons
+  PORTA = 0xFF;
+
+  if (size >= 5 + CHECKPOINT_BYTES && trace[4] == TRACE_CHECKPOINT) {
+    restore(&trace[5]); //the state at reset
+    i += 1 + CHECKPOINT_BYTES;
+  }
+  if (i + 7 <= size && trace[i] == TRACE_BANDS) {
+    current_fm_freq = trace[i + 1] | trace[i + 2] << 8;
+    current_am_freq = trace[i + 3] | trace[i + 4] << 8;
+    current_sw_freq = trace[i + 5] | trace[i + 6] << 8;
+    i += 7;
+  }
+  if (i + 1 + sizeof(alarms) <= size && trace[i] == TRACE_ALARMS) {
+    memcpy(alarms, &trace[i + 1], sizeof(alarms));
+    i += 1 + sizeof(alarms);
+  }
+
+  start = clock();
+  while (i < size) {
+    uint8_t b = trace[i++];
+    if (b < TRACE_NIBBLE) {
+      for (uint8_t n = 0; n <= b; n++) tick(pins, nibble);
+    }
+    else if (b < TRACE_PINS) {
+      nibble = b & 0x0F;
+      tick(pins, nibble);
+    }
+    else if (b < TRACE_PINS + 0x10) {
+      if (i + 1 > size) {truncated = true; break;}
+      nibble = b & 0x0F;
+      pins = trace[i++];
+      tick(pins, nibble);
+    }
+    else if (b == TRACE_FREQ) {
+      if (i + 2 > size) {truncated = true; break;}
+      band_freq_set(current_radio_band, trace[i] | trace[i + 1] << 8);
+      i += 2;
+    }
+    else if (b == TRACE_STATION) {
+      if (i + 2 > size) {truncated = true; break;}
+      encoder_freq = trace[i] | trace[i + 1] << 8;
+      i += 2;
+    }
+    else if (b == TRACE_SECOND) {clock_seconds++; seconds++;} //trimmed already
+    else if (b == TRACE_CHECKPOINT) {
+      if (i + CHECKPOINT_BYTES > size) {truncated = true; break;}
+      checkpoint(&trace[i]);
+      i += CHECKPOINT_BYTES;
+    }
+    else if (b == TRACE_LOST) lost++;
+    else {fprintf(stderr, "bad record 0x%02X at offset %zu\n", b, i - 1); return 2;}
+  }
+  host = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  state(final);
+  print_state("final", final);
+  printf("%llu ticks, %llu seconds, %llu checkpoints, %llu differ, %zu bytes",
+         (unsigned long long)ticks, (unsigned long long)seconds,
+         (unsigned long long)checkpoints, (unsigned long long)mismatches, size);
+  if (truncated) printf(" (truncated)");
+  printf("\n%.3f s host, %.0f ticks/s\n", host, host > 0 ? ticks / host : 0.0);
+  if (lost) printf("%llu gaps in the trace, replay is not exact after the first\n",
+                   (unsigned long long)lost);
+  return mismatches ? 1 : 0;
+}
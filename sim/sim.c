@@ -0,0 +1,300 @@
+//sim.c
+//Core of the host simulation: register file, virtual clock, timed events
+//and interrupt dispatch. See sim.h for the overall picture.
+//
+//Interrupts are taken between register accesses and while busy delays run,
+//the only places where the simulated cpu can observe the hardware. Code that
+//spins on a RAM flag set by an ISR (while(!STC_interrupt){}) makes no
+//register accesses at all, so a wall clock watchdog notices the silence and
+//moves the virtual clock on to the next event from a signal handler.
+
+#define _DEFAULT_SOURCE
+#define SIM_RAW_IO
+#include <avr/io.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "sim.h"
+
+#define SIM_WATCHDOG_US 100 //wall time without register traffic = spinning
+#define SIM_SPIN_CYCLES 8000 //virtual time a spin advances per watchdog, 500 us
+#define SIM_STALL_CYCLES (16000000ULL) //an ISR running this long has hung
+
+volatile uint8_t  sim_io[SIM_IO_SIZE];
+volatile uint16_t sim_spdr = 0x100;
+uint64_t          sim_cycles;
+uint64_t          sim_limit = SIM_NEVER;
+sim_stat_t        sim_stat[SIM_NUM_VECTORS];
+uint8_t           sim_vector;
+uint64_t          sim_sleep_cycles;
+
+static uint64_t          sim_isr_start;                //entry of running ISR
+static uint8_t           sim_flag[SIM_NUM_VECTORS];    //interrupt flags
+static uint64_t          sim_flag_at[SIM_NUM_VECTORS]; //cycle flag was raised
+static sim_event_t      *sim_events;                   //registered events
+static volatile uint64_t sim_accesses;                 //register accesses
+static volatile int      sim_busy;                     //inside simulator code
+static volatile int      sim_done;
+
+//Vectors the board can raise. Undefined ISRs stay NULL (weak), which the
+//dispatcher treats like avr-libc's __bad_interrupt, minus the reset.
+void __vector_8(void)  __attribute__((weak));
+void __vector_10(void) __attribute__((weak));
+void __vector_12(void) __attribute__((weak));
+void __vector_13(void) __attribute__((weak));
+void __vector_16(void) __attribute__((weak));
+void __vector_17(void) __attribute__((weak));
+void __vector_19(void) __attribute__((weak));
+void __vector_21(void) __attribute__((weak));
+void __vector_22(void) __attribute__((weak));
+void __vector_33(void) __attribute__((weak));
+
+static void (*sim_isr(uint8_t vector))(void){
+  switch (vector) {
+    case SIM_VECT_INT7:         return __vector_8;
+    case SIM_VECT_TIMER2_OVF:   return __vector_10;
+    case SIM_VECT_TIMER1_COMPA: return __vector_12;
+    case SIM_VECT_TIMER1_COMPB: return __vector_13;
+    case SIM_VECT_TIMER0_OVF:   return __vector_16;
+    case SIM_VECT_SPI_STC:      return __vector_17;
+    case SIM_VECT_USART0_UDRE:  return __vector_19;
+    case SIM_VECT_ADC:          return __vector_21;
+    case SIM_VECT_EE_READY:     return __vector_22;
+    case SIM_VECT_TWI:          return __vector_33;
+    default:                    return NULL;
+  }
+}
+
+uint8_t sim_isr_defined(uint8_t vector){return sim_isr(vector) != NULL;}
+
+const char *sim_vector_name(uint8_t vector){
+  switch (vector) {
+    case 0:                     return "main";
+    case SIM_VECT_INT7:         return "INT7";
+    case SIM_VECT_TIMER2_OVF:   return "TIMER2_OVF";
+    case SIM_VECT_TIMER1_COMPA: return "TIMER1_COMPA";
+    case SIM_VECT_TIMER1_COMPB: return "TIMER1_COMPB";
+    case SIM_VECT_TIMER0_OVF:   return "TIMER0_OVF";
+    case SIM_VECT_SPI_STC:      return "SPI_STC";
+    case SIM_VECT_USART0_UDRE:  return "USART0_UDRE";
+    case SIM_VECT_ADC:          return "ADC";
+    case SIM_VECT_EE_READY:     return "EE_READY";
+    case SIM_VECT_TWI:          return "TWI";
+    default:                    return "?";
+  }
+}
+
+//******************************************************************************
+//                                 events
+//******************************************************************************
+void sim_event_register(sim_event_t *ev){
+  ev->when = SIM_NEVER;
+  ev->next = sim_events;
+  sim_events = ev;
+}
+
+void sim_schedule(sim_event_t *ev, uint64_t delay){ev->when = sim_cycles + delay;}
+
+void sim_cancel(sim_event_t *ev){ev->when = SIM_NEVER;}
+
+static sim_event_t *sim_next_event(void){
+  sim_event_t *next = NULL;
+  for (sim_event_t *ev = sim_events; ev; ev = ev->next)
+    if (ev->when != SIM_NEVER && (!next || ev->when < next->when)) next = ev;
+  return next;
+}
+
+//******************************************************************************
+//                               interrupts
+//******************************************************************************
+void sim_raise(uint8_t vector){
+  if (sim_flag[vector]) {sim_stat[vector].missed++; return;}
+  sim_flag[vector] = 1;
+  sim_flag_at[vector] = sim_cycles;
+}
+
+void sim_lower(uint8_t vector){sim_flag[vector] = 0;}
+
+//Runs one ISR the way the cpu would: I bit cleared on entry, set again by
+//reti, flag cleared by hardware unless the source is level triggered.
+static void sim_take(uint8_t vector){
+  void (*isr)(void) = sim_isr(vector);
+  uint8_t  outer = sim_vector;
+  uint64_t start = sim_cycles;
+  sim_stat_t *st = &sim_stat[vector];
+
+  if (sim_flag[vector] && start - sim_flag_at[vector] > st->max_wait)
+    st->max_wait = start - sim_flag_at[vector];
+  if (vector != SIM_VECT_TWI && !sim_periph_level(vector)) sim_flag[vector] = 0;
+  if (!isr) {sim_flag[vector] = 0; return;}
+
+  sim_periph_taken(vector);
+  sim_vector = vector;
+  sim_isr_start = start;
+  SREG &= ~0x80;
+  sim_cycles += SIM_ISR_CYCLES;
+  isr();
+  sim_periph_sync();
+  SREG |= 0x80;
+  sim_vector = outer;
+  sim_isr_start = start;
+
+  st->calls++;
+  st->cycles += sim_cycles - start;
+  if (sim_cycles - start > st->max_cycles) st->max_cycles = sim_cycles - start;
+}
+
+static void sim_dispatch(void){
+  while (sim_vector == 0 && (SREG & 0x80)) {
+    uint8_t vector;
+    for (vector = 1; vector < SIM_NUM_VECTORS; vector++)
+      if ((sim_flag[vector] || sim_periph_level(vector)) && sim_periph_enabled(vector)) break;
+    if (vector == SIM_NUM_VECTORS) return;
+    sim_take(vector);
+  }
+}
+
+void sim_fire(uint8_t vector){
+  sim_busy++;
+  sim_periph_sync();
+  if (sim_vector) sim_raise(vector); //no nesting, taken after the running ISR
+  else            sim_take(vector);
+  sim_busy--;
+}
+
+void sim_sei(void){
+  sim_busy++;
+  sim_periph_sync();
+  SREG |= 0x80;
+  sim_dispatch();
+  sim_busy--;
+}
+
+void sim_cli(void){SREG &= ~0x80;}
+
+//******************************************************************************
+//                                 clock
+//Moves the clock forward by "cycles" of cpu work. Time spent in ISRs taken
+//on the way is added on top, just as an interrupted delay loop takes longer.
+//******************************************************************************
+void sim_run(uint64_t cycles){
+  sim_dispatch();
+  while (cycles) {
+    sim_event_t *ev = sim_next_event();
+    uint64_t step = cycles;
+    if (ev && ev->when <= sim_cycles) step = 0;
+    else if (ev && ev->when - sim_cycles < cycles) step = ev->when - sim_cycles;
+    sim_cycles += step;
+    cycles -= step;
+    while ((ev = sim_next_event()) && ev->when <= sim_cycles) {
+      ev->when = SIM_NEVER;
+      ev->fire();
+    }
+    if (sim_cycles >= sim_limit) sim_finish();
+    sim_dispatch();
+  }
+  if (sim_cycles >= sim_limit) sim_finish();
+  if (sim_vector && sim_cycles - sim_isr_start > SIM_STALL_CYCLES) {
+    //interrupts are off, nothing can release the ISR: the board is hung
+    printf("sim    %s has not returned for 1 s, firmware hung\n",
+           sim_vector_name(sim_vector));
+    sim_finish();
+  }
+}
+
+void sim_delay_cycles(uint64_t cycles){
+  sim_busy++;
+  sim_stat[sim_vector].delay += cycles;
+  sim_periph_sync();
+  sim_run(cycles);
+  sim_busy--;
+}
+
+//Sleep: the clock jumps to the next event, whose interrupt is what would
+//wake the cpu. An event that raises nothing just ends the sleep early, which
+//the firmware's idle loop cannot tell apart from a spurious wake up.
+void sim_sleep(void){
+  sim_event_t *ev;
+  uint64_t cycles;
+
+  sim_busy++;
+  sim_periph_sync();
+  ev = sim_next_event();
+  cycles = ev && ev->when > sim_cycles ? ev->when - sim_cycles : 1;
+  sim_sleep_cycles += cycles;
+  sim_run(cycles);
+  sim_busy--;
+}
+
+//******************************************************************************
+//                            register access
+//Each access first lets the peripherals see what the previous statement
+//wrote, then charges the access, then applies read side effects.
+//******************************************************************************
+static void sim_access(uint16_t addr){
+  sim_busy++;
+  sim_accesses++;
+  sim_periph_sync();
+  sim_run(SIM_ACCESS_CYCLES);
+  sim_periph_access(addr);
+  sim_busy--;
+}
+
+volatile uint8_t *sim_reg8(uint16_t addr){
+  sim_access(addr);
+  return &sim_io[addr];
+}
+
+volatile uint16_t *sim_reg16(uint16_t addr){
+  sim_access(addr);
+  return (volatile uint16_t *)&sim_io[addr];
+}
+
+volatile uint16_t *sim_spdr_reg(void){
+  sim_access(0x2F);
+  return &sim_spdr;
+}
+
+//******************************************************************************
+//                             spin watchdog
+//******************************************************************************
+static void sim_watchdog(int sig){
+  static uint64_t seen = SIM_NEVER;
+  sim_event_t *ev;
+  (void)sig;
+
+  if (sim_busy || sim_done) return;
+  if (sim_accesses != seen) {seen = sim_accesses; return;}
+
+  //no register traffic for a whole period: the firmware waits on RAM. Move
+  //on to the next event, but by at least 500 us so long spins (a 60 ms tune)
+  //do not take ages; the spin then ends at most that much late.
+  sim_busy++;
+  sim_periph_sync();
+  ev = sim_next_event();
+  if (ev && ev->when > sim_cycles + SIM_SPIN_CYCLES) sim_run(ev->when - sim_cycles);
+  else                                              sim_run(SIM_SPIN_CYCLES);
+  sim_busy--;
+  seen = sim_accesses;
+}
+
+void sim_start(void){
+  struct sigaction sa;
+  struct itimerval period = {{0, SIM_WATCHDOG_US}, {0, SIM_WATCHDOG_US}};
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = sim_watchdog;
+  sa.sa_flags = SA_RESTART;
+  sigaction(SIGALRM, &sa, NULL);
+  setitimer(ITIMER_REAL, &period, NULL);
+}
+
+//stops the watchdog; called once by sim_finish() before reporting
+void sim_stop(void){
+  struct itimerval off = {{0, 0}, {0, 0}};
+  sim_done = 1;
+  setitimer(ITIMER_REAL, &off, NULL);
+}
@@ -0,0 +1,114 @@
+//sim.h
+//Host simulation of the ATmega128 and the alarm clock board (make sim).
+//
+//The stand-in <avr/io.h> in this directory turns every special function
+//register into a call to sim_reg8()/sim_reg16(). Each call is one "bus
+//access": the simulator reacts to whatever the previous statement wrote,
+//lets virtual time pass, fires due peripheral events and takes pending
+//interrupts before handing back the register. Busy delays (_delay_us and
+//friends) advance the same virtual clock, so hours of clock time run in
+//seconds and the cost of every ISR can be measured in virtual cycles.
+//
+//sim.c        register file, virtual clock, events, interrupt dispatch
+//sim_periph.c timers, SPI chain (165/595/LCD/7-seg), TWI devices, ADC, EEPROM,
+//             USART0 transmitter
+//sim_main.c   command line, input stimulus and the end of run report
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+#define SIM_IO_SIZE        0x100        //data space covered by I/O registers
+#define SIM_NEVER          UINT64_MAX   //event not scheduled
+#define SIM_ACCESS_CYCLES  2            //virtual cost of one register access
+#define SIM_ISR_CYCLES     20           //prologue/epilogue of an ISR
+
+//interrupt vector numbers, same numbering as avr-libc for the mega128
+#define SIM_VECT_INT7          8
+#define SIM_VECT_TIMER2_OVF   10
+#define SIM_VECT_TIMER1_COMPA 12
+#define SIM_VECT_TIMER1_COMPB 13
+#define SIM_VECT_TIMER0_OVF   16
+#define SIM_VECT_SPI_STC      17
+#define SIM_VECT_USART0_UDRE  19
+#define SIM_VECT_ADC          21
+#define SIM_VECT_EE_READY     22
+#define SIM_VECT_TWI          33
+#define SIM_NUM_VECTORS       35
+
+//per vector accounting; index 0 collects the work done outside of ISRs
+typedef struct {
+  uint64_t calls;      //times the vector was taken
+  uint64_t cycles;     //virtual cycles spent inside, including busy waits
+  uint64_t max_cycles; //longest single run
+  uint64_t max_wait;   //longest time from flag raised to vector taken
+  uint64_t missed;     //flag raised again before the previous was serviced
+  uint64_t spi_bytes;  //SPI transfers started
+  uint64_t lcd_ops;    //HD44780 commands and characters latched
+  uint64_t delay;      //cycles burnt in _delay_us/_delay_ms
+} sim_stat_t;
+
+//a timed one-shot event owned by a peripheral model
+typedef struct sim_event {
+  uint64_t when;             //absolute cycle, SIM_NEVER when idle
+  void (*fire)(void);        //called once the clock reaches "when"
+  struct sim_event *next;    //registration list
+} sim_event_t;
+
+extern volatile uint8_t  sim_io[SIM_IO_SIZE]; //register file
+extern volatile uint16_t sim_spdr;            //SPDR, bit 8 set once consumed
+extern uint64_t          sim_cycles;          //virtual cycles since reset
+extern uint64_t          sim_limit;           //run ends at this cycle
+extern sim_stat_t        sim_stat[SIM_NUM_VECTORS];
+extern uint8_t           sim_vector;          //vector running, 0 for main
+extern uint64_t          sim_sleep_cycles;    //cycles the cpu spent asleep
+
+//register access hooks used by <avr/io.h>
+volatile uint8_t  *sim_reg8(uint16_t addr);
+volatile uint16_t *sim_reg16(uint16_t addr);
+volatile uint16_t *sim_spdr_reg(void);
+
+//cpu
+void sim_sei(void);
+void sim_cli(void);
+void sim_delay_cycles(uint64_t cycles);
+void sim_sleep(void);            //idle until the next event
+void sim_raise(uint8_t vector);  //set an interrupt flag
+void sim_lower(uint8_t vector);  //clear an interrupt flag
+void sim_fire(uint8_t vector);   //run an ISR now, as if it had just been taken
+uint8_t sim_isr_defined(uint8_t vector);
+const char *sim_vector_name(uint8_t vector);
+
+//events
+void sim_event_register(sim_event_t *ev);
+void sim_schedule(sim_event_t *ev, uint64_t delay);
+void sim_cancel(sim_event_t *ev);
+void sim_run(uint64_t cycles);   //advance the clock, taking interrupts
+void sim_start(void);            //arm the spin watchdog
+void sim_stop(void);             //disarm it before reporting
+void sim_finish(void);           //print the report and leave (sim_main.c)
+
+//peripheral models (sim_periph.c)
+void    sim_periph_init(void);
+void    sim_periph_sync(void);          //react to register writes
+void    sim_periph_access(uint16_t addr); //read side effects
+uint8_t sim_periph_enabled(uint8_t vector);
+uint8_t sim_periph_level(uint8_t vector);     //pending while its condition holds
+void    sim_periph_taken(uint8_t vector);   //hardware flag clear on entry
+void    sim_periph_report(void);
+
+//board inputs and outputs
+void    sim_set_buttons(uint8_t pressed);  //bit n set: button n held down
+void    sim_set_encoders(uint8_t nibble);  //raw 165 nibble, right in 3:2
+uint8_t sim_get_encoders(void);
+void    sim_set_temperature(int16_t centi_celsius);
+void    sim_set_light(uint16_t adc);
+void    sim_eeprom_load(const char *path);
+void    sim_eeprom_save(const char *path);
+void    sim_uart_capture(const char *path); //USART0 transmit bytes to a file
+extern char     sim_lcd_text[2][17];       //visible LCD contents
+extern uint8_t  sim_segments[5];           //last pattern per digit
+extern uint8_t  sim_bargraph;              //last byte latched into the 595
+
+#endif
@@ -0,0 +1,222 @@
+//sim_main.c
+//Entry point of the host simulation. Parses the command line, queues the
+//input stimulus, then hands control to the firmware's main() (renamed
+//firmware_main by the sim build). The run ends when the virtual clock
+//reaches the requested time; sim_finish() then prints what the board
+//shows and how much work every interrupt vector did.
+//
+//usage: lab4_sim [-s seconds] [-p button@ms[+hold]] [-e L|R<detents>@ms[/period]]
+//                [-t celsius] [-l adc] [-E eeprom.bin] [-T usart0.bin] [-q]
+//  -s  virtual run time in seconds (default 60)
+//  -p  press button 0-7 at the given time, held for 100 ms or "hold" ms
+//  -e  turn the left or right encoder, e.g. R+10@2000 or L-3@500, one detent
+//      every 100 ms or every "period" ms (R+40@2000/10 spins it fast)
+//  -t  LM73 temperature, -l photo resistor ADC value (0-1023)
+//  -E  EEPROM image, loaded before reset and saved at the end
+//  -T  write the bytes sent on USART0 to a file, e.g. the input trace of a
+//      DEFS=-DINPUT_TRACE build (see input_trace.h and replay.c)
+//  -q  only print the display contents
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sim.h"
+#include "../scheduler.h"
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+#define STIM_MAX        4096
+#define DETENT_MS       100  //default time per detent, a slow turn
+
+int firmware_main();
+
+//the scheduler's task table, when the firmware has one (index = priority)
+extern task_t        tasks[]   __attribute__((weak));
+extern const uint8_t num_tasks __attribute__((weak));
+
+typedef struct {
+  uint64_t when;             //cycle the input changes
+  uint8_t  kind;             //STIM_BUTTON or STIM_ENCODER
+  uint8_t  value;            //buttons held, or encoder nibble
+  uint8_t  mask;             //bits of the nibble the step applies to
+} stim_t;
+
+enum {STIM_BUTTON, STIM_ENCODER};
+
+static stim_t       stim[STIM_MAX];
+static uint16_t     stim_count, stim_next;
+static sim_event_t  stim_ev;
+static uint8_t      held;            //buttons currently held
+static const char  *eeprom_path;
+static int          quiet;
+static clock_t      host_start;
+
+//Quadrature states of one detent in the clockwise direction, ending at rest
+//on 11. Counter clockwise runs the table backwards.
+static const uint8_t quadrature[4] = {0x02, 0x00, 0x01, 0x03};
+
+static int stim_cmp(const void *a, const void *b){
+  const stim_t *x = a, *y = b;
+  return (x->when > y->when) - (x->when < y->when);
+}
+
+static void stim_add(uint64_t when, uint8_t kind, uint8_t value, uint8_t mask){
+  if (stim_count == STIM_MAX) {fprintf(stderr, "too much stimulus\n"); exit(2);}
+  stim[stim_count++] = (stim_t){when, kind, value, mask};
+}
+
+static void stim_fire(void){
+  uint8_t enc;
+  while (stim_next < stim_count && stim[stim_next].when <= sim_cycles) {
+    stim_t *s = &stim[stim_next++];
+    switch (s->kind) {
+      case STIM_BUTTON: sim_set_buttons(s->value); break;
+      case STIM_ENCODER:
+        enc = (sim_get_encoders() & ~s->mask) | (s->value & s->mask);
+        sim_set_encoders(enc);
+        break;
+    }
+  }
+  if (stim_next < stim_count) sim_schedule(&stim_ev, stim[stim_next].when - sim_cycles);
+}
+
+//button presses are kept as absolute "held" snapshots so they can overlap
+static void parse_press(const char *arg){
+  unsigned button, ms, hold = 100;
+  if (sscanf(arg, "%u@%u+%u", &button, &ms, &hold) < 2 || button > 7) {
+    fprintf(stderr, "bad -p %s\n", arg);
+    exit(2);
+  }
+  stim_add((uint64_t)ms * (F_CPU / 1000), STIM_BUTTON, 1 << button, 0xFF);
+  stim_add((uint64_t)(ms + hold) * (F_CPU / 1000), STIM_BUTTON, 1 << button, 0x00);
+}
+
+static void parse_encoder(const char *arg){
+  char side;
+  int  detents;
+  unsigned ms, period = DETENT_MS;
+  uint8_t mask, shift;
+  if (sscanf(arg, "%c%d@%u/%u", &side, &detents, &ms, &period) < 3 ||
+      (side != 'L' && side != 'R') || period < 4) {
+    fprintf(stderr, "bad -e %s\n", arg);
+    exit(2);
+  }
+  shift = side == 'R' ? 2 : 0;
+  mask = 0x03 << shift;
+  for (int d = 0; d < abs(detents); d++)
+    for (int q = 0; q < 4; q++) {
+      uint8_t state = detents > 0 ? quadrature[q] : quadrature[(6 - q) % 4];
+      uint64_t t = (uint64_t)ms + (uint64_t)(d * 4 + q) * period / 4;
+      stim_add(t * (F_CPU / 1000), STIM_ENCODER, state << shift, mask);
+    }
+}
+
+//turn the press/release pairs into absolute button snapshots in time order
+static void stim_prepare(void){
+  qsort(stim, stim_count, sizeof(stim[0]), stim_cmp);
+  held = 0;
+  for (uint16_t i = 0; i < stim_count; i++) {
+    if (stim[i].kind != STIM_BUTTON) continue;
+    if (stim[i].mask) held |= stim[i].value;
+    else              held &= ~stim[i].value;
+    stim[i].value = held;
+  }
+  sim_event_register(&stim_ev);
+  stim_ev.fire = stim_fire;
+  if (stim_count) sim_schedule(&stim_ev, stim[0].when);
+}
+
+//******************************************************************************
+//                                  report
+//******************************************************************************
+static char seg_char(uint8_t pattern){
+  static const uint8_t digits[10] = {0xC0, 0xF9, 0xA4, 0xB0, 0x99,
+                                     0x92, 0x82, 0xF8, 0x80, 0x98};
+  pattern |= 0x80; //decimal point
+  for (uint8_t i = 0; i < 10; i++) if (digits[i] == pattern) return '0' + i;
+  if (pattern == 0xFF) return ' ';
+  if (pattern == 0xFC) return ':';
+  return '?';
+}
+
+static void lcd_line(const char *label, const char *text){
+  printf("%s|", label);
+  for (uint8_t i = 0; i < 16; i++) {
+    unsigned char c = (unsigned char)text[i];
+    putchar(c == 0xDF ? 'o' : (c >= 0x20 && c < 0x7F) ? c : '?');
+  }
+  printf("|\n");
+}
+
+void sim_finish(void){
+  double host = (double)(clock() - host_start) / CLOCKS_PER_SEC;
+  sim_stop();
+
+  lcd_line("lcd    ", sim_lcd_text[0]);
+  lcd_line("       ", sim_lcd_text[1]);
+  printf("7seg    %c%c%c%c%c%s  bargraph 0x%02X\n",
+         seg_char(sim_segments[4]), seg_char(sim_segments[3]),
+         seg_char(sim_segments[2]), seg_char(sim_segments[1]),
+         seg_char(sim_segments[0]), (sim_segments[1] & 0x80) ? "" : " (dp)",
+         sim_bargraph);
+  if (eeprom_path) sim_eeprom_save(eeprom_path);
+  if (quiet) exit(0);
+
+  printf("sim    %.3f s simulated (%llu cycles) in %.2f s host, cpu asleep %.1f%%\n",
+         (double)sim_cycles / F_CPU, (unsigned long long)sim_cycles, host,
+         sim_cycles ? 100.0 * sim_sleep_cycles / sim_cycles : 0.0);
+  printf("%-13s %10s %9s %9s %9s %8s %9s %9s %11s\n", "vector", "calls",
+         "avg cyc", "max cyc", "max wait", "missed", "spi", "lcd", "delay us");
+  for (uint8_t v = 0; v < SIM_NUM_VECTORS; v++) {
+    sim_stat_t *st = &sim_stat[v];
+    if (v && !st->calls && !st->missed) continue;
+    printf("%-13s %10llu %9llu %9llu %9llu %8llu %9llu %9llu %11llu\n",
+           sim_vector_name(v), (unsigned long long)st->calls,
+           (unsigned long long)(st->calls ? st->cycles / st->calls : 0),
+           (unsigned long long)st->max_cycles, (unsigned long long)st->max_wait,
+           (unsigned long long)st->missed, (unsigned long long)st->spi_bytes,
+           (unsigned long long)st->lcd_ops,
+           (unsigned long long)(st->delay / (F_CPU / 1000000UL)));
+  }
+  if (tasks && &num_tasks) {
+    printf("%-13s %10s %9s %13s\n", "task", "runs", "overruns", "max late ms");
+    for (uint8_t i = 0; i < num_tasks; i++)
+      printf("task %-8u %10u %9u %13.1f\n", i, tasks[i].runs, tasks[i].overruns,
+             tasks[i].max_latency * 1.024);
+  }
+  sim_periph_report();
+  exit(0);
+}
+
+int main(int argc, char *argv[]){
+  double seconds = 60;
+
+  for (int i = 1; i < argc; i++) {
+    const char *opt = argv[i], *arg = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!strcmp(opt, "-q")) {quiet = 1; continue;}
+    if (!arg) {fprintf(stderr, "missing value for %s\n", opt); return 2;}
+    i++;
+    if      (!strcmp(opt, "-s")) seconds = atof(arg);
+    else if (!strcmp(opt, "-p")) parse_press(arg);
+    else if (!strcmp(opt, "-e")) parse_encoder(arg);
+    else if (!strcmp(opt, "-t")) sim_set_temperature((int16_t)(atof(arg) * 100));
+    else if (!strcmp(opt, "-l")) sim_set_light((uint16_t)atoi(arg));
+    else if (!strcmp(opt, "-E")) {eeprom_path = arg; sim_eeprom_load(arg);}
+    else if (!strcmp(opt, "-T")) sim_uart_capture(arg);
+    else {fprintf(stderr, "unknown option %s\n", opt); return 2;}
+  }
+
+  sim_limit = (uint64_t)(seconds * F_CPU);
+  sim_periph_init();
+  stim_prepare();
+  host_start = clock();
+  sim_start();
+  firmware_main();
+  sim_finish();
+  return 0;
+}
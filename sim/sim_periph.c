@@ -0,0 +1,806 @@
+//sim_periph.c
+//Peripheral models for the host simulation: the three timers that raise
+//interrupts, the SPI chain (74HC165 encoder input, 74HC595 bar graph and the
+//HD44780 LCD behind its shift register), the 7-segment multiplexer on
+//PORTA/PORTB, the TWI bus with the LM73 and Si4734, the ADC, the EEPROM and
+//the USART0 transmitter.
+//
+//Write side effects are found in sim_periph_sync() by comparing registers
+//with what was last seen, so a write is noticed at the next register access.
+//Registers written with identical values (SPDR, TWCR) carry a marker that
+//the model clears once it has acted on the write.
+
+#define SIM_RAW_IO
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <util/twi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+#define US(x) ((uint64_t)(x) * (F_CPU / 1000000UL)) //microseconds to cycles
+#define MS(x) ((uint64_t)(x) * (F_CPU / 1000UL))    //milliseconds to cycles
+
+char    sim_lcd_text[2][17];
+uint8_t sim_segments[5] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+uint8_t sim_bargraph;
+
+static uint8_t  buttons;            //pressed buttons, active low on PINA
+static uint8_t  encoders = 0x0F;    //encoder nibble, detents rest at 11
+static int16_t  temperature = 2200; //LM73 reading in 1/100 degree C
+static uint16_t light = 512;        //photo resistor ADC value
+
+static uint8_t  prev_portb, prev_portf;
+
+//******************************************************************************
+//                                  timers
+//TIMER0 runs from the 32.768 kHz crystal when AS0 is set, TIMER1 is used in
+//CTC mode on OCR1A with a compare match on OCR1B, TIMER2 overflows at 256
+//counts in normal or fast PWM. OCF1B shows in TIFR for polling; a TIFR
+//access that finds it set consumes it, which stands in for the write of a
+//one that clears it (the firmware only polls OCF1B to clear it).
+//******************************************************************************
+static sim_event_t t0_ev, t1_ev, t1b_ev, t2_ev;
+static uint64_t    t0_period, t1_period, t2_period; //cycles, 0 when stopped
+static uint64_t    t0_base, t1_base, t2_base;       //cycle of last overflow/clear
+static uint16_t    prev_ocr1b;
+static uint8_t     prev_ocie1b;
+static uint8_t     ocf1b, tifr_seen;
+
+static uint64_t timer0_period(void){
+  static const uint16_t prescale[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+  uint8_t cs = TCCR0 & 0x07;
+  if (!cs) return 0;
+  if (ASSR & _BV(AS0)) return 256ULL * prescale[cs] * F_CPU / 32768;
+  return 256ULL * prescale[cs];
+}
+
+static uint64_t timer1_period(void){
+  static const uint16_t prescale[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+  uint8_t cs = TCCR1B & 0x07;
+  if (!prescale[cs] || !(TCCR1B & _BV(WGM12))) return 0;
+  return (OCR1A + 1ULL) * prescale[cs];
+}
+
+static uint64_t timer2_period(void){
+  static const uint16_t prescale[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+  return 256ULL * prescale[TCCR2 & 0x07];
+}
+
+static void t0_fire(void){
+  t0_base = sim_cycles;
+  if (TIMSK & _BV(TOIE0)) sim_raise(SIM_VECT_TIMER0_OVF);
+  sim_schedule(&t0_ev, t0_period);
+}
+
+static void t1_fire(void){
+  t1_base = sim_cycles;
+  if (TIMSK & _BV(OCIE1A)) sim_raise(SIM_VECT_TIMER1_COMPA);
+  sim_schedule(&t1_ev, t1_period);
+}
+
+//TCNT1 counts 0..OCR1A
+static uint16_t timer1_count(void){
+  if (!t1_period) return TCNT1;
+  return (uint16_t)((sim_cycles - t1_base) % t1_period * (OCR1A + 1ULL) / t1_period);
+}
+
+//next cycle at which TCNT1 reaches OCR1B
+static void t1b_schedule(void){
+  uint64_t at;
+  if (!t1_period || OCR1B > OCR1A) {sim_cancel(&t1b_ev); return;}
+  at = t1_base + t1_period / (OCR1A + 1ULL) * OCR1B;
+  while (at <= sim_cycles) at += t1_period;
+  sim_schedule(&t1b_ev, at - sim_cycles);
+}
+
+static void t1b_fire(void){
+  ocf1b = 1;
+  if (TIMSK & _BV(OCIE1B)) sim_raise(SIM_VECT_TIMER1_COMPB);
+  sim_schedule(&t1b_ev, t1_period);
+}
+
+static void t2_fire(void){
+  t2_base = sim_cycles;
+  if (TIMSK & _BV(TOIE2)) sim_raise(SIM_VECT_TIMER2_OVF);
+  sim_schedule(&t2_ev, t2_period);
+}
+
+//restart a timer whose clock or top changed
+static void timer_sync(sim_event_t *ev, uint64_t *period, uint64_t now_period,
+                       uint64_t *base){
+  if (now_period == *period) return;
+  *period = now_period;
+  if (base) *base = sim_cycles;
+  if (now_period) sim_schedule(ev, now_period);
+  else            sim_cancel(ev);
+}
+
+//******************************************************************************
+//                       SPI, 74HC165, 74HC595, 7-segment
+//SPDR is 16 bits in the simulation: a firmware write leaves bit 8 clear, the
+//model sets it once the transfer has been started.
+//******************************************************************************
+static sim_event_t spi_ev;
+static uint8_t     spi_tx;          //byte being shifted out
+static uint8_t     spi_active;
+static uint8_t     spi_out[2];      //last two bytes shifted out, oldest first
+static uint8_t     spif_seen;       //SPSR read with SPIF set
+static uint8_t     hc165 = 0xFF;    //parallel data latched into the 165
+static uint64_t    spi_collisions;
+
+static uint64_t spi_cycles(void){
+  static const uint8_t divisor[4] = {4, 16, 64, 128};
+  uint64_t div = divisor[SPCR & 0x03];
+  if (SPSR & _BV(SPI2X)) div /= 2;
+  return 8 * div;
+}
+
+static void spi_fire(void){
+  spi_out[0] = spi_out[1];
+  spi_out[1] = spi_tx;
+  sim_spdr = 0x100 | hc165;
+  spi_active = 0;
+  SPSR |= _BV(SPIF);
+  if (SPCR & _BV(SPIE)) sim_raise(SIM_VECT_SPI_STC);
+}
+
+static void spi_sync(void){
+  if (sim_spdr & 0x100) return;
+  spi_tx = (uint8_t)sim_spdr;
+  sim_spdr |= 0x100;
+  if (!(SPCR & _BV(SPE))) return;
+  if (spi_active) {spi_collisions++; SPSR |= _BV(WCOL); return;}
+  SPSR &= ~(_BV(SPIF) | _BV(WCOL));
+  spi_active = 1;
+  sim_stat[sim_vector].spi_bytes++;
+  sim_schedule(&spi_ev, spi_cycles());
+}
+
+//******************************************************************************
+//                                  HD44780
+//Latched from the SPI shift register on the rising edge of PORTF bit 3. The
+//first byte selects command (0) or data (1), the second is the payload.
+//******************************************************************************
+static uint8_t  lcd_ddram[0x80];
+static uint8_t  lcd_cgram[0x40];
+static uint8_t  lcd_ac;             //address counter
+static uint8_t  lcd_cg;             //address counter points into CGRAM
+static uint64_t lcd_ready_at;       //busy flag clears at this cycle
+static uint64_t lcd_chars, lcd_cmds, lcd_busy_hits, lcd_clears;
+
+static void lcd_text_update(void){
+  memcpy(sim_lcd_text[0], &lcd_ddram[0x00], 16);
+  memcpy(sim_lcd_text[1], &lcd_ddram[0x40], 16);
+  sim_lcd_text[0][16] = sim_lcd_text[1][16] = '\0';
+}
+
+static void lcd_latch(uint8_t rs, uint8_t data){
+  uint64_t busy = US(37);
+
+  sim_stat[sim_vector].lcd_ops++;
+  if (sim_cycles < lcd_ready_at) lcd_busy_hits++;
+
+  if (rs) {
+    lcd_chars++;
+    busy = US(41);
+    if (lcd_cg) {lcd_cgram[lcd_ac & 0x3F] = data; lcd_ac = (lcd_ac + 1) & 0x3F;}
+    else {
+      lcd_ddram[lcd_ac] = data;
+      if      (lcd_ac == 0x27) lcd_ac = 0x40;
+      else if (lcd_ac == 0x67) lcd_ac = 0x00;
+      else                     lcd_ac = (lcd_ac + 1) & 0x7F;
+    }
+  }
+  else {
+    lcd_cmds++;
+    if      (data & 0x80) {lcd_ac = data & 0x7F; lcd_cg = 0;}
+    else if (data & 0x40) {lcd_ac = data & 0x3F; lcd_cg = 1;}
+    else if (data == 0x01) {
+      memset(lcd_ddram, ' ', sizeof(lcd_ddram));
+      lcd_ac = 0; lcd_cg = 0; lcd_clears++;
+      busy = US(1520);
+    }
+    else if ((data & 0xFE) == 0x02) {lcd_ac = 0; lcd_cg = 0; busy = US(1520);}
+  }
+  lcd_ready_at = sim_cycles + busy;
+  lcd_text_update();
+}
+
+//******************************************************************************
+//                                TWI devices
+//******************************************************************************
+typedef struct {
+  uint8_t  addr;                    //8 bit bus address, R/W bit clear
+  void    (*start)(uint8_t rw);
+  void    (*write)(uint8_t data);
+  uint8_t (*read)(void);
+  void    (*stop)(void);
+  uint64_t transactions;
+} twi_dev_t;
+
+//LM73: pointer register, temperature, configuration and control/status
+static uint8_t lm73_ptr, lm73_first, lm73_idx;
+static uint8_t lm73_config = 0x40, lm73_ctrl = 0x00;
+
+static void lm73_start(uint8_t rw){lm73_idx = 0; if (!rw) lm73_first = 1;}
+
+static void lm73_write(uint8_t data){
+  if (lm73_first) {lm73_ptr = data; lm73_first = 0; return;}
+  if (lm73_ptr == 0x01) lm73_config = data;
+  if (lm73_ptr == 0x04) lm73_ctrl   = data;
+}
+
+static uint8_t lm73_read(void){
+  static const uint16_t keep[4] = {0xFFE0, 0xFFF0, 0xFFF8, 0xFFFC};
+  uint16_t reading = (uint16_t)((int32_t)temperature * 128 / 100);
+  reading &= keep[(lm73_ctrl >> 5) & 0x03]; //resolution from RES bits
+  switch (lm73_ptr) {
+    case 0x00: return lm73_idx++ ? (uint8_t)reading : (uint8_t)(reading >> 8);
+    case 0x01: return lm73_config & ~0x04;   //one shot bit reads back clear
+    case 0x04: return lm73_ctrl | 0x08;      //DAV, data available
+    default:   return 0xFF;
+  }
+}
+
+//Si4734: commands are executed at STOP, replies are read back afterwards.
+//CTS is modelled so commands sent before the previous one finished show up
+//as violations. A completed tune or seek sets STCINT, which stays set until
+//a TUNE_STATUS with INTACK clears it, as on the chip: GPO2/INT pulses INT7
+//only when STCINT goes from 0 to 1 (or on every completion with STCREP in
+//GPO_IEN), and only with STCIEN set. A tune that ends with STCINT still set
+//gives no pulse and is counted as a missed STC. A seek takes
+//SI_SEEK_MS per channel it passes, up to the next channel whose RSSI reaches
+//FM_SEEK_TUNE_RSSI_THRESHOLD, in 200 kHz steps over FM_SEEK_BAND_BOTTOM to
+//FM_SEEK_BAND_TOP, 87.5-107.9 MHz after a power up.
+#define SI_BAND_BOTTOM 8750   //reset values of the seek band
+#define SI_BAND_TOP    10790
+#define SI_SPACING     20
+#define SI_SEEK_MS     5
+#define SI_STCIEN      0x0001 //GPO_IEN bits
+#define SI_STCREP      0x0200
+
+static sim_event_t si_stc_ev;
+static uint8_t  si_cmd[16], si_len;
+static uint8_t  si_resp[16], si_resp_len, si_ridx, si_reading;
+static uint8_t  si_powered, si_stc, si_bltf;
+static uint16_t si_gpo_ien;
+static uint8_t  si_seek_rssi = 20;
+static uint16_t si_freq;
+static uint16_t si_band_bottom = SI_BAND_BOTTOM, si_band_top = SI_BAND_TOP;
+static uint64_t si_cts_at;
+static uint64_t si_pwr_ups, si_pwr_downs, si_props, si_tunes, si_seeks, si_cts_hits, si_stc_missed;
+
+static uint8_t si_rssi(uint16_t freq){
+  static const uint16_t stations[] = {8930, 9470, 9990, 10330, 10570};
+  uint8_t best = 8;
+  for (uint8_t i = 0; i < sizeof(stations) / sizeof(stations[0]); i++) {
+    uint16_t d = freq > stations[i] ? freq - stations[i] : stations[i] - freq;
+    if (d == 0 && best < 45) best = 45;
+    else if (d <= 20 && best < 20) best = 20;
+  }
+  return best;
+}
+
+static uint8_t si_status(void){return 0x80 | (si_stc ? 0x01 : 0x00);}
+
+//moves si_freq to the next channel at or above the seek threshold and
+//returns the number of channels passed
+static uint16_t si_seek(uint8_t up, uint8_t wrap){
+  uint16_t start = si_freq, steps = 0;
+
+  si_bltf = 0;
+  do {
+    if (up && si_freq >= si_band_top) {
+      if (!wrap) {si_bltf = 1; break;}
+      si_freq = si_band_bottom;
+    }
+    else if (!up && si_freq <= si_band_bottom) {
+      if (!wrap) {si_bltf = 1; break;}
+      si_freq = si_band_top;
+    }
+    else si_freq = up ? si_freq + SI_SPACING : si_freq - SI_SPACING;
+    steps++;
+    if (si_freq == start) {si_bltf = 1; break;} //went all the way round
+  } while (si_rssi(si_freq) < si_seek_rssi);
+  return steps;
+}
+
+static void si_stc_fire(void){
+  uint8_t rising = !si_stc;
+
+  si_stc = 1;
+  if ((si_gpo_ien & SI_STCIEN) && (rising || (si_gpo_ien & SI_STCREP))) sim_raise(SIM_VECT_INT7);
+  else si_stc_missed++;
+}
+
+static void si_execute(void){
+  uint8_t rssi;
+
+  if (sim_cycles < si_cts_at) si_cts_hits++;
+  si_cts_at = sim_cycles + US(300);
+  si_resp_len = 1;
+  si_resp[0] = si_status();
+
+  switch (si_cmd[0]) {
+    case 0x01: si_powered = 1; si_pwr_ups++; si_cts_at = sim_cycles + MS(110); si_stc = 0; si_gpo_ien = 0;
+               si_band_bottom = SI_BAND_BOTTOM; si_band_top = SI_BAND_TOP; break;
+    case 0x11: si_powered = 0; si_pwr_downs++; break;
+    case 0x12:
+      si_props++;
+      si_cts_at = sim_cycles + MS(10);
+      if ((si_cmd[2] << 8 | si_cmd[3]) == 0x1404) si_seek_rssi = si_cmd[5];
+      if ((si_cmd[2] << 8 | si_cmd[3]) == 0x0001) si_gpo_ien = (uint16_t)(si_cmd[4] << 8 | si_cmd[5]);
+      if ((si_cmd[2] << 8 | si_cmd[3]) == 0x1400) si_band_bottom = (uint16_t)(si_cmd[4] << 8 | si_cmd[5]);
+      if ((si_cmd[2] << 8 | si_cmd[3]) == 0x1401) si_band_top = (uint16_t)(si_cmd[4] << 8 | si_cmd[5]);
+      break;
+    case 0x20:
+    case 0x40:
+      si_freq = (uint16_t)(si_cmd[2] << 8 | si_cmd[3]);
+      si_tunes++;
+      si_bltf = 0;
+      if (si_powered) sim_schedule(&si_stc_ev, MS(60));
+      break;
+    case 0x21:
+      si_seeks++;
+      if (si_powered) sim_schedule(&si_stc_ev, MS(60) + MS(SI_SEEK_MS) * si_seek(si_cmd[1] & 0x08, si_cmd[1] & 0x04));
+      break;
+    case 0x22:
+    case 0x42:
+    case 0x23:
+    case 0x43:
+      if (si_cmd[1] & 0x01) si_stc = 0;
+      rssi = si_rssi(si_freq);
+      si_resp[0] = si_status();
+      si_resp[1] = (rssi >= si_seek_rssi ? 0x01 : 0x00) | (si_bltf ? 0x80 : 0x00); //VALID, BLTF
+      si_resp[2] = (uint8_t)(si_freq >> 8);
+      si_resp[3] = (uint8_t)si_freq;
+      si_resp[4] = rssi;
+      si_resp[5] = rssi > 10 ? rssi - 10 : 0; //SNR
+      si_resp[6] = 0;
+      si_resp[7] = 0;
+      si_resp_len = 8;
+      break;
+    default: break;
+  }
+}
+
+static void si_start(uint8_t rw){
+  si_reading = rw;
+  if (rw) si_ridx = 0;
+  else    si_len = 0;
+}
+
+static void si_write(uint8_t data){if (si_len < sizeof(si_cmd)) si_cmd[si_len++] = data;}
+
+static uint8_t si_read(void){return si_ridx < si_resp_len ? si_resp[si_ridx++] : si_status();}
+
+static void si_stop(void){if (!si_reading && si_len) si_execute();}
+
+static twi_dev_t twi_devs[] = {
+  {0x90, lm73_start, lm73_write, lm73_read, NULL,    0},
+  {0x22, si_start,   si_write,   si_read,   si_stop, 0},
+};
+
+//******************************************************************************
+//                                TWI master
+//TWCR is stored with TWINT clear; a firmware write with TWINT set starts the
+//next bus action and the completion raises the (level triggered) TWI flag.
+//******************************************************************************
+enum {TWI_IDLE, TWI_STARTED, TWI_MT, TWI_MR, TWI_NACKED};
+static sim_event_t twi_ev;
+static uint8_t     twi_phase = TWI_IDLE;
+static uint8_t     twi_next_status, twi_next_data, twi_has_data;
+static twi_dev_t  *twi_dev;
+static uint64_t    twi_bytes;
+
+static uint64_t twi_bit_cycles(void){
+  static const uint8_t prescale[4] = {1, 4, 16, 64};
+  return 16 + 2ULL * TWBR * prescale[TWSR & 0x03];
+}
+
+static void twi_fire(void){
+  TWSR = (TWSR & 0x03) | twi_next_status;
+  if (twi_has_data) TWDR = twi_next_data;
+  twi_has_data = 0;
+  sim_raise(SIM_VECT_TWI);
+}
+
+static void twi_end(void){
+  if (twi_dev && twi_dev->stop) twi_dev->stop();
+  twi_dev = NULL;
+}
+
+static void twi_sync(void){
+  uint8_t cr = TWCR;
+
+  if (!(cr & _BV(TWINT))) return;
+  TWCR = cr & ~(_BV(TWINT) | _BV(TWSTO));
+  sim_lower(SIM_VECT_TWI);
+  if (!(cr & _BV(TWEN))) return;
+
+  if (cr & _BV(TWSTO)) {
+    twi_end();
+    twi_phase = TWI_IDLE;
+    if (!(cr & _BV(TWSTA))) return; //else STOP then START
+  }
+
+  if (cr & _BV(TWSTA)) {
+    twi_next_status = (twi_phase == TWI_IDLE) ? TW_START : TW_REP_START;
+    twi_end();
+    twi_phase = TWI_STARTED;
+    sim_schedule(&twi_ev, 10 * twi_bit_cycles());
+    return;
+  }
+
+  switch (twi_phase) {
+    case TWI_STARTED: {
+      uint8_t sla = TWDR, rw = sla & 0x01;
+      twi_dev = NULL;
+      for (uint8_t i = 0; i < sizeof(twi_devs) / sizeof(twi_devs[0]); i++)
+        if (twi_devs[i].addr == (sla & 0xFE)) twi_dev = &twi_devs[i];
+      if (twi_dev) {
+        twi_dev->transactions++;
+        twi_dev->start(rw);
+        twi_phase = rw ? TWI_MR : TWI_MT;
+        twi_next_status = rw ? TW_MR_SLA_ACK : TW_MT_SLA_ACK;
+      }
+      else {
+        twi_phase = TWI_NACKED;
+        twi_next_status = rw ? TW_MR_SLA_NACK : TW_MT_SLA_NACK;
+      }
+      break;
+    }
+    case TWI_MT:
+      twi_dev->write(TWDR);
+      twi_next_status = TW_MT_DATA_ACK;
+      break;
+    case TWI_MR:
+      twi_next_data = twi_dev->read();
+      twi_has_data = 1;
+      twi_next_status = (cr & _BV(TWEA)) ? TW_MR_DATA_ACK : TW_MR_DATA_NACK;
+      break;
+    default:
+      twi_next_status = TW_BUS_ERROR;
+      break;
+  }
+  twi_bytes++;
+  sim_schedule(&twi_ev, 9 * twi_bit_cycles());
+}
+
+//******************************************************************************
+//                                    ADC
+//******************************************************************************
+static sim_event_t adc_ev;
+
+static void adc_fire(void){
+  ADC = light;
+  ADCSRA = (ADCSRA & ~_BV(ADSC)) | _BV(ADIF);
+  sim_raise(SIM_VECT_ADC);
+}
+
+static void adc_sync(void){
+  static const uint8_t prescale[8] = {2, 2, 4, 8, 16, 32, 64, 128};
+  if (!(ADCSRA & _BV(ADEN)) || !(ADCSRA & _BV(ADSC))) return;
+  if (adc_ev.when != SIM_NEVER) return;
+  sim_schedule(&adc_ev, 13ULL * prescale[ADCSRA & 0x07]);
+}
+
+//******************************************************************************
+//                             USART0 transmitter
+//The firmware only ever writes UDR0, so any access to it counts as a write.
+//UDRE0 clears for one frame time (10 bits at the UBRR0 baud rate) and the
+//byte goes to the capture file, if there is one.
+//******************************************************************************
+static sim_event_t uart_ev;
+static uint8_t     uart_pending;    //UDR0 touched since the last sync
+static FILE       *uart_file;
+static uint64_t    uart_bytes;
+
+static void uart_fire(void){UCSR0A |= _BV(UDRE0) | _BV(TXC0);}
+
+static void uart_sync(void){
+  uint16_t ubrr = ((UBRR0H & 0x0F) << 8) | UBRR0L;
+  if (!uart_pending) return;
+  uart_pending = 0;
+  if (!(UCSR0B & _BV(TXEN0))) return;
+  uart_bytes++;
+  if (uart_file) fputc(UDR0, uart_file);
+  UCSR0A &= ~(_BV(UDRE0) | _BV(TXC0));
+  sim_schedule(&uart_ev, 10ULL * 16 * (ubrr + 1));
+}
+
+void sim_uart_capture(const char *path){
+  uart_file = fopen(path, "wb");
+  if (!uart_file) {perror(path); exit(2);}
+}
+
+//******************************************************************************
+//                                  EEPROM
+//A byte write takes 8.5 ms (mega128 datasheet, 8448 cycles of the 1 MHz
+//calibrated oscillator); the next access waits for it, as avr-libc does.
+//Register level accesses work as well: EERE reads the cell at EEAR into
+//EEDR, EEWE with EEMWE still set programs EEDR into it, and EE_READY is
+//pending while EERIE is set and no write is in progress.
+//******************************************************************************
+#define EE_SIZE     (E2END + 1)
+#define EE_WRITE_US 8500
+
+extern char __start_sim_eeprom[] __attribute__((weak));
+extern char __stop_sim_eeprom[]  __attribute__((weak));
+
+static uint8_t  ee_mem[EE_SIZE];
+static uint32_t ee_writes[EE_SIZE];
+static uint64_t ee_ready_at;
+static uint64_t ee_total_writes;
+static uint8_t  ee_loaded;
+static uint8_t  ee_mwe_syncs;   //syncs EEMWE has been set for
+static sim_event_t ee_ev;       //end of a write, wakes a sleeping cpu
+
+static uint16_t ee_addr(const void *p){
+  const char *c = p;
+  if (__start_sim_eeprom && c >= __start_sim_eeprom && c < __stop_sim_eeprom)
+    return (uint16_t)(c - __start_sim_eeprom);
+  return (uint16_t)((uintptr_t)p & E2END);
+}
+
+static void ee_wait(void){
+  if (sim_cycles < ee_ready_at) sim_delay_cycles(ee_ready_at - sim_cycles);
+}
+
+uint8_t eeprom_is_ready(void){return sim_cycles >= ee_ready_at;}
+
+uint8_t eeprom_read_byte(const uint8_t *p){
+  ee_wait();
+  sim_delay_cycles(4);
+  return ee_mem[ee_addr(p)];
+}
+
+uint16_t eeprom_read_word(const uint16_t *p){
+  const uint8_t *b = (const uint8_t *)p;
+  return eeprom_read_byte(b) | (uint16_t)eeprom_read_byte(b + 1) << 8;
+}
+
+void eeprom_read_block(void *dst, const void *src, size_t n){
+  for (size_t i = 0; i < n; i++)
+    ((uint8_t *)dst)[i] = eeprom_read_byte((const uint8_t *)src + i);
+}
+
+static void ee_program(uint16_t a, uint8_t value){
+  ee_mem[a] = value;
+  ee_writes[a]++;
+  ee_total_writes++;
+  ee_ready_at = sim_cycles + US(EE_WRITE_US);
+  sim_schedule(&ee_ev, US(EE_WRITE_US));
+}
+
+static void ee_fire(void){} //EE_READY is a level, seen by sim_periph_enabled()
+
+//EECR as the previous statement left it. EEMWE clears by itself 4 cycles
+//after it was set, here by the second sync without EEWE.
+static void ee_sync(void){
+  uint8_t eecr = EECR;
+
+  if (eecr & _BV(EERE)) {
+    EEDR = ee_mem[EEAR & E2END];
+    eecr &= ~_BV(EERE);
+  }
+  if ((eecr & _BV(EEWE)) && (eecr & _BV(EEMWE)) && sim_cycles >= ee_ready_at) {
+    ee_program(EEAR & E2END, EEDR);
+    eecr &= ~(_BV(EEWE) | _BV(EEMWE));
+  }
+  if (!(eecr & _BV(EEMWE)))  ee_mwe_syncs = 0;
+  else if (++ee_mwe_syncs > 1) {eecr &= ~_BV(EEMWE); ee_mwe_syncs = 0;}
+  EECR = eecr;
+}
+
+void eeprom_write_byte(uint8_t *p, uint8_t value){
+  uint16_t a = ee_addr(p);
+  ee_wait();
+  ee_program(a, value);
+}
+
+void eeprom_write_word(uint16_t *p, uint16_t value){
+  eeprom_write_byte((uint8_t *)p, (uint8_t)value);
+  eeprom_write_byte((uint8_t *)p + 1, (uint8_t)(value >> 8));
+}
+
+void eeprom_write_block(const void *src, void *dst, size_t n){
+  for (size_t i = 0; i < n; i++)
+    eeprom_write_byte((uint8_t *)dst + i, ((const uint8_t *)src)[i]);
+}
+
+void eeprom_update_byte(uint8_t *p, uint8_t value){
+  if (eeprom_read_byte(p) != value) eeprom_write_byte(p, value);
+}
+
+void eeprom_update_word(uint16_t *p, uint16_t value){
+  eeprom_update_byte((uint8_t *)p, (uint8_t)value);
+  eeprom_update_byte((uint8_t *)p + 1, (uint8_t)(value >> 8));
+}
+
+void eeprom_update_block(const void *src, void *dst, size_t n){
+  for (size_t i = 0; i < n; i++)
+    eeprom_update_byte((uint8_t *)dst + i, ((const uint8_t *)src)[i]);
+}
+
+void sim_eeprom_load(const char *path){
+  FILE *f = fopen(path, "rb");
+  if (!f) return;
+  ee_loaded = fread(ee_mem, 1, EE_SIZE, f) == EE_SIZE;
+  fclose(f);
+}
+
+void sim_eeprom_save(const char *path){
+  FILE *f = fopen(path, "wb");
+  if (!f) return;
+  fwrite(ee_mem, 1, EE_SIZE, f);
+  fclose(f);
+}
+
+//******************************************************************************
+//                                 interface
+//******************************************************************************
+void sim_periph_init(void){
+  sim_event_register(&t0_ev);  t0_ev.fire  = t0_fire;
+  sim_event_register(&t1_ev);  t1_ev.fire  = t1_fire;
+  sim_event_register(&t1b_ev); t1b_ev.fire = t1b_fire;
+  sim_event_register(&t2_ev);  t2_ev.fire  = t2_fire;
+  sim_event_register(&spi_ev); spi_ev.fire = spi_fire;
+  sim_event_register(&twi_ev); twi_ev.fire = twi_fire;
+  sim_event_register(&adc_ev); adc_ev.fire = adc_fire;
+  sim_event_register(&si_stc_ev); si_stc_ev.fire = si_stc_fire;
+  sim_event_register(&uart_ev); uart_ev.fire = uart_fire;
+  sim_event_register(&ee_ev);   ee_ev.fire   = ee_fire;
+
+  UCSR0A = _BV(UDRE0);
+
+  if (!ee_loaded) memset(ee_mem, 0xFF, sizeof(ee_mem));
+  memset(lcd_ddram, ' ', sizeof(lcd_ddram));
+  lcd_text_update();
+}
+
+void sim_periph_sync(void){
+  uint8_t portb = PORTB, porte = PORTE, portf = PORTF;
+
+  timer_sync(&t0_ev, &t0_period, timer0_period(), &t0_base);
+  if (timer1_period() != t1_period) {
+    timer_sync(&t1_ev, &t1_period, timer1_period(), &t1_base);
+    t1b_schedule();
+  }
+  if (OCR1B != prev_ocr1b || (TIMSK & _BV(OCIE1B)) != prev_ocie1b) {
+    prev_ocr1b  = OCR1B;
+    prev_ocie1b = TIMSK & _BV(OCIE1B);
+    t1b_schedule();
+  }
+  if (tifr_seen) {
+    if (TIFR & _BV(OCF1B)) {ocf1b = 0; sim_lower(SIM_VECT_TIMER1_COMPB);}
+    TIFR &= ~_BV(OCF1B);
+    tifr_seen = 0;
+  }
+  timer_sync(&t2_ev, &t2_period, timer2_period(), &t2_base);
+
+  spi_sync();
+  twi_sync();
+  adc_sync();
+  uart_sync();
+  ee_sync();
+
+  //74HC165 parallel load while SH/LD (PE6) is low
+  if (!(porte & _BV(PE6))) hc165 = 0xF0 | encoders;
+
+  //74HC595 storage clock on the rising edge of PB0
+  if ((portb & 0x01) && !(prev_portb & 0x01)) sim_bargraph = spi_out[1];
+
+  //digit select on PB6:4, segments on PORTA
+  if (portb != prev_portb && DDRA == 0xFF && ((portb >> 4) & 0x07) < 5)
+    sim_segments[(portb >> 4) & 0x07] = PORTA;
+
+  //LCD enable strobe on the rising edge of PF3
+  if ((portf & 0x08) && !(prev_portf & 0x08)) lcd_latch(spi_out[0], spi_out[1]);
+
+  prev_portb = portb;
+  prev_portf = portf;
+}
+
+void sim_periph_access(uint16_t addr){
+  switch (addr) {
+    case 0x39: //PINA, buttons pull PINA low
+      PINA = (PORTA & DDRA) | (~DDRA & ~buttons);
+      break;
+    case 0x2E: //SPSR
+      spif_seen = (SPSR & _BV(SPIF)) != 0;
+      break;
+    case 0x2F: //SPDR, SPIF clears after reading SPSR with it set
+      if (spif_seen) {SPSR &= ~_BV(SPIF); sim_lower(SIM_VECT_SPI_STC);}
+      spif_seen = 0;
+      break;
+    case 0x52: //TCNT0
+      if (t0_period) TCNT0 = (uint8_t)((sim_cycles - t0_base) * 256 / t0_period);
+      break;
+    case 0x56: //TIFR
+      if (ocf1b) TIFR |= _BV(OCF1B);
+      tifr_seen = 1;
+      break;
+    case 0x4C: //TCNT1
+      TCNT1 = timer1_count();
+      break;
+    case 0x44: //TCNT2
+      if (t2_period) TCNT2 = (uint8_t)((sim_cycles - t2_base) * 256 / t2_period);
+      break;
+    case 0x2C: //UDR0
+      uart_pending = 1;
+      break;
+    case 0x3C: //EECR
+      if (sim_cycles < ee_ready_at) EECR |= _BV(EEWE);
+      else                          EECR &= ~_BV(EEWE);
+      break;
+    default: break;
+  }
+}
+
+uint8_t sim_periph_enabled(uint8_t vector){
+  switch (vector) {
+    case SIM_VECT_INT7:         return EIMSK  & _BV(INT7);
+    case SIM_VECT_TIMER2_OVF:   return TIMSK  & _BV(TOIE2);
+    case SIM_VECT_TIMER1_COMPA: return TIMSK  & _BV(OCIE1A);
+    case SIM_VECT_TIMER1_COMPB: return TIMSK  & _BV(OCIE1B);
+    case SIM_VECT_TIMER0_OVF:   return TIMSK  & _BV(TOIE0);
+    case SIM_VECT_SPI_STC:      return SPCR   & _BV(SPIE);
+    case SIM_VECT_ADC:          return ADCSRA & _BV(ADIE);
+    case SIM_VECT_EE_READY:     return (EECR & _BV(EERIE)) && sim_cycles >= ee_ready_at;
+    case SIM_VECT_TWI:          return TWCR   & _BV(TWIE);
+    case SIM_VECT_USART0_UDRE:  return (UCSR0B & _BV(UDRIE0)) && (UCSR0A & _BV(UDRE0));
+    default:                    return 0;
+  }
+}
+
+uint8_t sim_periph_level(uint8_t vector){
+  return vector == SIM_VECT_EE_READY || vector == SIM_VECT_USART0_UDRE;
+}
+
+void sim_periph_taken(uint8_t vector){
+  switch (vector) {
+    case SIM_VECT_SPI_STC: SPSR   &= ~_BV(SPIF); break;
+    case SIM_VECT_TIMER1_COMPB: ocf1b = 0; break;
+    case SIM_VECT_ADC:     ADCSRA &= ~_BV(ADIF); break;
+    default: break;
+  }
+}
+
+void sim_periph_report(void){
+  uint32_t ee_max = 0;
+  for (uint16_t i = 0; i < EE_SIZE; i++) if (ee_writes[i] > ee_max) ee_max = ee_writes[i];
+
+  printf("spi    %llu collisions\n", (unsigned long long)spi_collisions);
+  printf("lcd    %llu chars, %llu commands, %llu clears, %llu sent while busy\n",
+         (unsigned long long)lcd_chars, (unsigned long long)lcd_cmds,
+         (unsigned long long)lcd_clears, (unsigned long long)lcd_busy_hits);
+  printf("twi    %llu bytes, lm73 %llu transactions, si4734 %llu transactions\n",
+         (unsigned long long)twi_bytes, (unsigned long long)twi_devs[0].transactions,
+         (unsigned long long)twi_devs[1].transactions);
+  printf("si4734 %llu power ups, %llu power downs, %llu properties, %llu tunes, "
+         "%llu seeks, %llu commands before CTS, %llu STC without a pulse, tuned to %u\n",
+         (unsigned long long)si_pwr_ups, (unsigned long long)si_pwr_downs,
+         (unsigned long long)si_props, (unsigned long long)si_tunes,
+         (unsigned long long)si_seeks, (unsigned long long)si_cts_hits,
+         (unsigned long long)si_stc_missed, si_freq);
+  printf("eeprom %llu byte writes, worst cell %u\n",
+         (unsigned long long)ee_total_writes, ee_max);
+  if (uart_bytes) printf("usart0 %llu bytes sent\n", (unsigned long long)uart_bytes);
+}
+
+//******************************************************************************
+//                                board inputs
+//******************************************************************************
+void    sim_set_buttons(uint8_t pressed){buttons = pressed;}
+void    sim_set_encoders(uint8_t nibble){encoders = nibble & 0x0F;}
+uint8_t sim_get_encoders(void){return encoders;}
+void    sim_set_temperature(int16_t centi_celsius){temperature = centi_celsius;}
+void    sim_set_light(uint16_t adc){light = adc & 0x03FF;}
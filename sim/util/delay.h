@@ -0,0 +1,22 @@
+//util/delay.h (host simulation stand-in)
+//Busy delays advance the virtual clock instead of spinning. Interrupts that
+//come due during the delay are taken, just as they would be on the board.
+
+#ifndef SIM_UTIL_DELAY_H
+#define SIM_UTIL_DELAY_H
+
+#include "sim.h"
+
+#ifndef F_CPU
+#define F_CPU 1000000UL
+#endif
+
+static inline void _delay_us(double us){
+  sim_delay_cycles((uint64_t)(us * (F_CPU / 1000000.0)));
+}
+
+static inline void _delay_ms(double ms){
+  sim_delay_cycles((uint64_t)(ms * (F_CPU / 1000.0)));
+}
+
+#endif
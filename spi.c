@@ -0,0 +1,123 @@
+// spi.c
+// Interrupt driven SPI job queue for the 74HC165/74HC595 chain and the LCD.
+// See spi.h for what a job is.
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "spi.h"
+#include "hd44780.h"
+
+#define SPI_QUEUE_MASK (SPI_QUEUE_SIZE - 1)
+
+typedef struct {
+  uint8_t    tx[2];
+  uint8_t    len;
+  uint8_t    flags;
+  spi_done_t done;
+} spi_job_t;
+
+static spi_job_t        spi_jobs[SPI_QUEUE_SIZE];
+static volatile uint8_t spi_head;    //next free slot
+static volatile uint8_t spi_tail;    //job on the bus
+static volatile uint8_t spi_active;  //a byte of spi_jobs[spi_tail] is shifting
+static uint8_t          spi_sent;    //bytes of that job started so far
+static uint8_t          spi_irq;     //SPI_STC drives the queue
+volatile uint16_t       spi_waits;
+
+//puts the first byte of the tail job on the bus, interrupts off
+static void spi_begin(void){
+  spi_job_t *job = &spi_jobs[spi_tail];
+
+  if (job->flags & SPI_LOAD_165) {
+    PORTE &= ~(1 << PE6);  //load data in the 165
+    PORTE |=  (1 << PE6);  //shift data out the 165
+  }
+  spi_active = 1;
+  spi_sent = 1;
+  SPDR = job->tx[0];
+}
+
+//****************************************************************************
+//                              spi_next
+//A byte finished shifting. Starts the next byte of the job, or finishes the
+//job with its latch/strobe, starts the next job and hands the received byte
+//to the job's callback. Runs with interrupts off.
+//****************************************************************************
+static void spi_next(void){
+  spi_job_t *job = &spi_jobs[spi_tail];
+  uint8_t rx = SPDR;
+  spi_done_t done;
+
+  if (spi_sent < job->len) {SPDR = job->tx[spi_sent++]; return;}
+
+  if (job->flags & SPI_LATCH_595) {
+    PORTB |=  0x01;  //rising edge for ss_n pin on 595
+    PORTB &= ~0x01;  //falling edge for ss_n pin on 595
+  }
+  if (job->flags & SPI_STROBE_LCD) strobe_lcd();
+  done = job->done;
+
+  spi_tail = (spi_tail + 1) & SPI_QUEUE_MASK;
+  if (spi_tail != spi_head) spi_begin();
+  else spi_active = 0;
+
+  if (done) done(rx);
+}
+
+ISR(SPI_STC_vect){
+  spi_next();
+}
+
+//moves the bus along without the ISR, interrupts off
+static void spi_poll(void){
+  while (bit_is_clear(SPSR, SPIF)){}
+  spi_next();
+}
+
+//****************************************************************************
+//                              spi_queue
+//Queues a transfer of len (1 or 2) bytes, b0 first. A full queue is waited
+//out, or run by polling when interrupts are off (called from an ISR).
+//Before spi_irq_enable() the job is finished when this returns.
+//****************************************************************************
+void spi_queue(uint8_t b0, uint8_t b1, uint8_t len, uint8_t flags, spi_done_t done){
+  uint8_t sreg = SREG;
+  spi_job_t *job;
+
+  cli();
+  if (((spi_head + 1) & SPI_QUEUE_MASK) == spi_tail) spi_waits++;
+  while (((spi_head + 1) & SPI_QUEUE_MASK) == spi_tail) {
+    if (spi_irq && (sreg & (1 << SREG_I))) {
+      SREG = sreg;  //let SPI_STC drain it
+      while (((spi_head + 1) & SPI_QUEUE_MASK) == spi_tail){}
+      cli();        //and look again, an ISR may have queued meanwhile
+    }
+    else spi_poll();
+  }
+
+  job = &spi_jobs[spi_head];
+  job->tx[0] = b0;
+  job->tx[1] = b1;
+  job->len   = len;
+  job->flags = flags;
+  job->done  = done;
+  spi_head = (spi_head + 1) & SPI_QUEUE_MASK;
+  if (!spi_active) spi_begin();
+
+  if (!spi_irq) {while (spi_active) spi_poll();}
+  SREG = sreg;
+}
+
+//hands the queue to SPI_STC, call once interrupts are on
+void spi_irq_enable(void){
+  uint8_t sreg = SREG;
+  cli();
+  while (spi_active) spi_poll();
+  spi_irq = 1;
+  SPCR |= (1 << SPIE);
+  SREG = sreg;
+}
+
+uint8_t spi_busy(void){
+  return spi_active;
+}
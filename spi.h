@@ -0,0 +1,32 @@
+//spi.h
+//Interrupt driven SPI job queue shared by the 74HC165/74HC595 chain and the
+//LCD. A job is one to two bytes shifted full duplex, with the pin pulses the
+//board needs before and after them. SPI_STC starts the next byte or job, so
+//nobody spins on SPIF.
+//
+//Until spi_irq_enable() is called (after sei() in main) every job completes
+//before spi_queue() returns, as the polled code did, so the LCD init
+//sequence keeps its timing.
+
+#ifndef SPI_H
+#define SPI_H
+
+#include <stdint.h>
+
+//job flags
+#define SPI_LOAD_165    0x01  //pulse PE6 low before the first byte, parallel load
+#define SPI_LATCH_595   0x02  //pulse PB0 after the last byte, bar graph latch
+#define SPI_STROBE_LCD  0x04  //strobe_lcd() after the last byte
+
+#define SPI_QUEUE_SIZE  8     //power of two
+
+//called from the SPI ISR with the last byte received
+typedef void (*spi_done_t)(uint8_t rx);
+
+extern volatile uint16_t spi_waits;  //spi_queue() calls that found the queue full
+
+void    spi_queue(uint8_t b0, uint8_t b1, uint8_t len, uint8_t flags, spi_done_t done);
+void    spi_irq_enable(void);
+uint8_t spi_busy(void);
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef STATIONS_H
+#define STATIONS_H
+
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include "globals.h"
+#include "settings.h"
+#include "eeprom_queue.h"
+
+//******************************************************************************
+//                              station index
+//The FM stations a band scan found, kept in EEPROM behind the settings
+//journal so presets work from reset on. The index has an address of its own
+//rather than the end of the journal, so a larger settings record does not
+//move it; firmware from before the 32-byte records kept it at
+//STATION_BASE_V1, and station_load() moves one found there.
+//
+//An entry is three bytes: the channel as FM_SPACING steps from the bottom of
+//the band (si4734.h), which is the bottom of the encoder's FM band and of
+//the chip's seeks alike, and the RSSI and SNR the chip reported there. Entries are in frequency order; when more than STATION_MAX
+//stations answer, the weakest are dropped.
+//
+//The scan fills the index from the si4734 callbacks; station_save() then
+//hands it to the EEPROM write queue. The index is written once per scan,
+//so it needs no wear leveling.
+//******************************************************************************
+#define STATION_VERSION 1
+#define STATION_MAX     16
+#define STATION_BASE    0x400  //EEPROM address, after the 1 KB journal
+#define STATION_BASE_V1 0x1C0  //after the journal of 14-byte records
+
+typedef struct {
+	uint8_t chan;  //(freq - FM_BAND_BOTTOM) / FM_SPACING
+	uint8_t rssi;  //dBuV
+	uint8_t snr;   //dB
+} station_t;
+
+typedef struct {
+	uint8_t   version;
+	uint8_t   count;
+	station_t station[STATION_MAX];
+	uint8_t   crc;  //CRC-8 of the bytes before it
+} station_index_t;
+
+_Static_assert(SETTINGS_ADDR(SETTINGS_SLOTS) <= STATION_BASE, "the settings journal runs into the station index");
+
+station_index_t stations;        //read by the EEPROM queue while saving
+bool            station_saving = false;
+
+static uint8_t station_crc(void) {
+	const uint8_t *b = (const uint8_t *)&stations;
+	uint8_t crc = 0;
+
+	for (uint8_t i = 0; i < offsetof(station_index_t, crc); i++) {crc = _crc8_ccitt_update(crc, b[i]);}
+	return crc;
+}
+
+uint16_t station_freq(uint8_t i) {
+	return FM_BAND_BOTTOM + stations.station[i].chan * FM_SPACING;
+}
+
+static bool station_read(uint16_t base) {
+	eeprom_read_block(&stations, (const void *)(uintptr_t)base, sizeof(stations));
+	return stations.version == STATION_VERSION && stations.count <= STATION_MAX &&
+	       stations.crc == station_crc();
+}
+
+void station_save(void);
+
+//at reset, before sei(); an index that fails its check is dropped. The old
+//address is slot 14 of the journal now, whose records start with
+//SETTINGS_VERSION, never STATION_VERSION, so only an index left there by
+//the old firmware passes the check.
+void station_load(void) {
+	if (station_read(STATION_BASE)) {return;}
+	if (station_read(STATION_BASE_V1)) {station_save(); return;} //moved on sei()
+	stations.count = 0;
+}
+
+//true while the last index is still going out; it must not change until then
+bool station_busy(void) {
+	if (station_saving && !ee_busy()) {station_saving = false;}
+	return station_saving;
+}
+
+void station_clear(void) {
+	stations.count = 0;
+}
+
+//******************************************************************************
+//                              station_add
+//From the scan, in rising frequency order. A full index makes room by
+//dropping its weakest entry, if that is weaker than the new one.
+//******************************************************************************
+void station_add(uint16_t freq, uint8_t rssi, uint8_t snr) {
+	uint8_t n = stations.count;
+
+	if (n == STATION_MAX) {
+		uint8_t weakest = 0;
+
+		for (uint8_t i = 1; i < n; i++) {
+			if (stations.station[i].rssi < stations.station[weakest].rssi) {weakest = i;}
+		}
+		if (stations.station[weakest].rssi >= rssi) {return;}
+		for (n--; weakest < n; weakest++) {stations.station[weakest] = stations.station[weakest + 1];}
+	}
+	stations.station[n] = (station_t){(freq - FM_BAND_BOTTOM) / FM_SPACING, rssi, snr};
+	stations.count = n + 1;
+}
+
+//queues the index for EEPROM; the queue skips the bytes that did not change
+void station_save(void) {
+	stations.version = STATION_VERSION;
+	stations.crc = station_crc();
+	station_saving = ee_queue(STATION_BASE, &stations, sizeof(stations));
+}
+
+//******************************************************************************
+//                              station_next
+//The preset after (dir > 0) or before (dir < 0) "freq", wrapping around the
+//band, or 0 when the index is empty.
+//******************************************************************************
+uint16_t station_next(uint16_t freq, int8_t dir) {
+	uint8_t n = stations.count;
+
+	if (!n) {return 0;}
+	if (dir > 0) {
+		for (uint8_t i = 0; i < n; i++) {
+			if (station_freq(i) > freq) {return station_freq(i);}
+		}
+		return station_freq(0);
+	}
+	for (uint8_t i = n; i > 0; i--) {
+		if (station_freq(i - 1) < freq) {return station_freq(i - 1);}
+	}
+	return station_freq(n - 1);
+}
+
+#endif
@@ -18,6 +18,50 @@ volatile uint8_t  *twi_buf;      //pointer to the buffer we are xferred from/to
 volatile uint8_t  twi_msg_size;  //number of bytes to be xferred
 volatile uint8_t  twi_bus_addr;  //address of device on TWI bus 
 volatile uint8_t  twi_state;     //status of transaction  
+volatile uint8_t  twi_overflows; //transactions refused on a full queue
+
+//Transactions waiting for the bus. The one at twi_tail is on the bus, the
+//ISR starts the next one as soon as it ends. twi_head is only written by
+//twi_queue(), twi_tail only by the ISR.
+typedef struct {
+  uint8_t    addr;  //SLA+R/W
+  uint8_t   *buf;
+  uint8_t    len;
+  twi_done_t done;
+} twi_job_t;
+
+static twi_job_t        twi_jobs[TWI_QUEUE_SIZE];
+static volatile uint8_t twi_head, twi_tail;
+
+//loads the transaction at twi_tail for the ISR
+static void twi_load(void){
+  twi_job_t *job = &twi_jobs[twi_tail];
+  twi_bus_addr = job->addr;
+  twi_buf = job->buf;
+  twi_msg_size = job->len;
+}
+
+static uint8_t twi_finishing; //in twi_finish(), which starts what gets queued
+
+//****************************************************************************
+//Reports "status" (0 or the TWSR of the error) to the callback of the
+//transaction on the bus, then ends it with STOP and starts the next one, if
+//any, with a START right after the STOP. This includes a transaction the
+//callback itself queued.
+//****************************************************************************
+static void twi_finish(uint8_t status){
+  twi_done_t done = twi_jobs[twi_tail].done;
+
+  twi_tail = (twi_tail + 1) & (TWI_QUEUE_SIZE - 1);
+  twi_finishing = 1;
+  if (done) {done(status);}
+  twi_finishing = 0;
+  if (twi_tail != twi_head) {
+    twi_load();
+    TWCR = TWCR_STOP_START;
+  }
+  else {TWCR = TWCR_STOP;}
+}
 
 //****************************************************************************
 //This is the TWI ISR. Different actions are taken depending upon the value
@@ -39,7 +83,7 @@ ISR(TWI_vect){
         TWDR = twi_buf[twi_buf_ptr++];  //load next and postincrement index
         TWCR = TWCR_SEND;               //send next byte 
       }
-      else{TWCR = TWCR_STOP;}           //last byte sent, send STOP 
+      else{twi_finish(0);}              //last byte sent, send STOP 
       break;
     case TW_MR_DATA_ACK:                //Data byte has been rcvd, ACK xmitted, fall through
       twi_buf[twi_buf_ptr++] = TWDR;    //fill buffer with rcvd data
@@ -49,52 +93,77 @@ ISR(TWI_vect){
       break; 
     case TW_MR_DATA_NACK: //Data byte was rcvd and NACK xmitted
       twi_buf[twi_buf_ptr] = TWDR;      //save last byte to buffer
-      TWCR = TWCR_STOP;                 //initiate a STOP
+      twi_finish(0);                    //initiate a STOP
       break;      
     case TW_MT_ARB_LOST:                //Arbitration lost 
       TWCR = TWCR_START;                //initiate RESTART 
       break;
     default:                            //Error occured, save TWSR 
       twi_state = TWSR;         
-      TWCR = TWCR_RST;                  //Reset TWI, disable interupts 
+      twi_finish(twi_state);            //give up on this one, release the bus
   }//switch
 }//TWI_isr
 //****************************************************************************
 
 //*****************************************************************************
-//Call this function to test if the TWI unit is busy transferring data. The TWI
-//code uses the the interrupt enable bit (TWIE) to indicate if the TWI unit
-//is busy or not.  This protocol must be maintained for correct operation.
+//Call this function to test if the TWI unit is busy transferring data: true
+//while a transaction is on the bus or waiting in the queue.
 //*****************************************************************************
 uint8_t twi_busy(void){
-  return (bit_is_set(TWCR,TWIE)); //if interrupt is enabled, twi is busy
+  return twi_head != twi_tail;
+}
+//*****************************************************************************
+
+//*****************************************************************************
+//Free slots of the queue. A caller that needs several transactions to go
+//out together checks this and queues them with interrupts off.
+//*****************************************************************************
+uint8_t twi_room(void){
+  return (twi_tail - twi_head - 1) & (TWI_QUEUE_SIZE - 1);
 }
 //*****************************************************************************
 
 //****************************************************************************
-//Initiates a write transfer. Loads global variables. Sends START. ISR handles
-//the rest.
+//Queues a transaction and starts it if the bus is idle; the ISR handles the
+//rest and calls "done" (may be NULL) from interrupt context when it ended.
+//twi_addr carries the R/W bit. Never waits: returns 0 if the queue is full.
+//The buffer must stay untouched until the transaction is done.
+//Callable from main() and from ISRs.
 //****************************************************************************
-void twi_start_wr(uint8_t twi_addr, uint8_t *twi_data, uint8_t byte_cnt){
+uint8_t twi_queue(uint8_t twi_addr, uint8_t *twi_data, uint8_t byte_cnt, twi_done_t done){
+  uint8_t sreg = SREG;
+  uint8_t next, idle;
 
-  while(twi_busy());                    //wait till TWI rdy for next xfer
-  twi_bus_addr = (twi_addr & ~TW_READ); //set twi bus address, mark as write 
-  twi_buf = twi_data;                   //load pointer to write buffer
-  twi_msg_size = byte_cnt;              //load size of xfer 
-  TWCR = TWCR_START;                    //initiate START
+  cli();
+  next = (twi_head + 1) & (TWI_QUEUE_SIZE - 1);
+  if (next == twi_tail) {
+    twi_overflows++;
+    SREG = sreg;
+    return 0;
+  }
+  twi_jobs[twi_head] = (twi_job_t){twi_addr, twi_data, byte_cnt, done};
+  idle = (twi_head == twi_tail) && !twi_finishing;
+  twi_head = next;
+  if (idle) {
+    twi_load();
+    TWCR = TWCR_START;                  //initiate START
+  }
+  SREG = sreg;
+  return 1;
 }
 
 //****************************************************************************
-//Initiates a read transfer. Loads global variables. Sends START. ISR handles
-//the rest.
+//Queues a write transfer, see twi_queue().
 //****************************************************************************
-void twi_start_rd(uint8_t twi_addr, uint8_t *twi_data, uint8_t byte_cnt){
+uint8_t twi_start_wr(uint8_t twi_addr, uint8_t *twi_data, uint8_t byte_cnt){
+  return twi_queue(twi_addr & ~TW_READ, twi_data, byte_cnt, NULL); //mark as write
+}
 
-  while(twi_busy());                   //wait till TWI rdy for next xfer
-  twi_bus_addr = (twi_addr | TW_READ); //set twi bus address, mark as read  
-  twi_buf = twi_data;                  //load pointer to write buffer
-  twi_msg_size = byte_cnt;             //load size of xfer 
-  TWCR = TWCR_START;                   //initiate START
+//****************************************************************************
+//Queues a read transfer, see twi_queue().
+//****************************************************************************
+uint8_t twi_start_rd(uint8_t twi_addr, uint8_t *twi_data, uint8_t byte_cnt){
+  return twi_queue(twi_addr | TW_READ, twi_data, byte_cnt, NULL);  //mark as read
 }
 //******************************************************************************
 //                            init_twi                               
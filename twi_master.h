@@ -24,14 +24,24 @@
 #define TWCR_RNACK  0x85 //receive byte and return NACK to slave
 #define TWCR_RST    0x04 //reset TWI
 #define TWCR_STOP   0x94 //send STOP,interrupt off, signals completion
+#define TWCR_STOP_START 0xB5 //send STOP then START, for the next transaction
 
 #endif
 
 #define TWI_BUFFER_SIZE 17  //SLA+RW (1 byte) +  16 data bytes (message size)
+#define TWI_QUEUE_SIZE  8   //transactions, power of two, one slot kept free
+
+//called from the TWI ISR when a queued transaction ended: status is 0, or
+//the TWSR value of the error that aborted it
+typedef void (*twi_done_t)(uint8_t status);
+
+extern volatile uint8_t twi_overflows;
 
 uint8_t twi_busy(void);
-void    twi_start_wr(uint8_t twi_addr, uint8_t *twi_data, uint8_t byte_cnt);
-void    twi_start_rd(uint8_t twi_addr, uint8_t *twi_data, uint8_t byte_cnt);
+uint8_t twi_room(void);
+uint8_t twi_queue(uint8_t twi_addr, uint8_t *twi_data, uint8_t byte_cnt, twi_done_t done);
+uint8_t twi_start_wr(uint8_t twi_addr, uint8_t *twi_data, uint8_t byte_cnt);
+uint8_t twi_start_rd(uint8_t twi_addr, uint8_t *twi_data, uint8_t byte_cnt);
 void    init_twi();
 
 